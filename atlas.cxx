@@ -10,7 +10,9 @@
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <future>
 #include <memory>
@@ -42,10 +44,18 @@
 
 #include <Math/Vector4D.h>
 
+#include "blockcache.h"
+#include "cachedwebfile.h"
+#include "treecache.h"
 #include "util.h"
 
 bool g_perf_stats = false;
 bool g_show = false;
+std::string g_result_path;
+std::string g_block_cache_dir;
+std::uint64_t g_block_cache_limit = BlockCache::kDefaultSizeLimit;
+TreeCacheConfig g_tree_cache;
+TreeUnzipConfig g_tree_unzip;
 
 static ROOT::Experimental::RNTupleReadOptions GetRNTupleOptions() {
    using RNTupleReadOptions = ROOT::Experimental::RNTupleReadOptions;
@@ -209,6 +219,57 @@ static void Show(TH1D *data, TH1D *ggH, TH1D *VBF, TH1F *hCut = nullptr) {
 }
 
 
+static void WriteResult(TH1D *data, TH1F *hCut) {
+   std::unique_ptr<TFile> f(TFile::Open(g_result_path.c_str(), "RECREATE"));
+   if (!f || f->IsZombie()) {
+      fprintf(stderr, "cannot write result file %s\n", g_result_path.c_str());
+      abort();
+   }
+   f->WriteTObject(data, "hData");
+   f->WriteTObject(hCut, "hCut");
+   f->Close();
+   std::cout << "Wrote histograms to " << g_result_path << std::endl;
+}
+
+
+/**
+ * Non-owning access to the items of a vector field in a given entry.  The items are read one by one through the
+ * item view from the page buffers, so that no std::vector is materialized per entry.
+ */
+template <typename T>
+class ItemSpan {
+   ROOT::Experimental::RNTupleView<T> *fItemView;
+   std::uint64_t fFirst;
+   std::size_t fSize;
+
+public:
+   ItemSpan(ROOT::Experimental::RNTupleViewCollection *collectionView, ROOT::Experimental::RNTupleView<T> *itemView,
+            std::uint64_t entry)
+      : fItemView(itemView)
+      , fFirst(*collectionView->GetCollectionRange(entry).begin())
+      , fSize((*collectionView)(entry))
+   {}
+
+   std::size_t size() const { return fSize; }
+   T operator[](std::size_t i) const { return (*fItemView)(fFirst + i); }
+};
+
+
+/// The collection view and the item view of a vector field
+template <typename T>
+struct VectorView {
+   ROOT::Experimental::RNTupleViewCollection fCollection;
+   ROOT::Experimental::RNTupleView<T> fItems;
+
+   VectorView(ROOT::Experimental::RNTupleReader *ntuple, const std::string &fieldName, const std::string &itemType)
+      : fCollection(ntuple->GetViewCollection(fieldName))
+      , fItems(ntuple->GetView<T>(fieldName + "." + itemType))
+   {}
+
+   ItemSpan<T> operator()(std::uint64_t entry) { return ItemSpan<T>(&fCollection, &fItems, entry); }
+};
+
+
 static float ComputeInvariantMass(
    float pt0, float pt1, float eta0, float eta1, float phi0, float phi1, float e0, float e1)
 {
@@ -227,19 +288,23 @@ static TH1F * ProcessNTuple(ROOT::Experimental::RNTupleReader *ntuple, TH1D *hMa
 
    auto viewTrigP           = ntuple->GetView<bool>("trigP");
    auto viewPhotonN         = ntuple->GetView<std::uint32_t>("photon_n");
-   auto viewPhotonIsTightId = ntuple->GetView<std::vector<bool>>("photon_isTightID");
-   auto viewPhotonPt        = ntuple->GetView<std::vector<float>>("photon_pt");
-   auto viewPhotonEta       = ntuple->GetView<std::vector<float>>("photon_eta");
-   auto viewPhotonPhi       = ntuple->GetView<std::vector<float>>("photon_phi");
-   auto viewPhotonE         = ntuple->GetView<std::vector<float>>("photon_E");
-   auto viewPhotonPtCone30  = ntuple->GetView<std::vector<float>>("photon_ptcone30");
-   auto viewPhotonEtCone20  = ntuple->GetView<std::vector<float>>("photon_etcone20");
+   VectorView<bool>  viewPhotonIsTightId(ntuple, "photon_isTightID", "bool");
+   VectorView<float> viewPhotonPt(ntuple, "photon_pt", "float");
+   VectorView<float> viewPhotonEta(ntuple, "photon_eta", "float");
+   VectorView<float> viewPhotonPhi(ntuple, "photon_phi", "float");
+   VectorView<float> viewPhotonE(ntuple, "photon_E", "float");
+   VectorView<float> viewPhotonPtCone30(ntuple, "photon_ptcone30", "float");
+   VectorView<float> viewPhotonEtCone20(ntuple, "photon_etcone20", "float");
 
    auto viewScaleFactorPhoton        = ntuple->GetView<float>("scaleFactor_PHOTON");
    auto viewScaleFactorPhotonTrigger = ntuple->GetView<float>("scaleFactor_PhotonTRIGGER");
    auto viewScaleFactorPileUp        = ntuple->GetView<float>("scaleFactor_PILEUP");
    auto viewMcWeight                 = ntuple->GetView<float>("mcWeight");
 
+   // Reused across events so that the photon selection does not allocate
+   std::vector<size_t> idxGood;
+   idxGood.reserve(8);
+
    unsigned nevents = 0;
    std::chrono::steady_clock::time_point ts_first;
    for (auto e : ntuple->GetEntryRange()) {
@@ -254,7 +319,7 @@ static TH1F * ProcessNTuple(ROOT::Experimental::RNTupleReader *ntuple, TH1D *hMa
 
       if (!viewTrigP(e)) continue;
 
-      std::vector<size_t> idxGood;
+      idxGood.clear();
       auto isTightId = viewPhotonIsTightId(e);
       auto pt = viewPhotonPt(e);
       auto eta = viewPhotonEta(e);
@@ -355,6 +420,8 @@ static void NTupleDirect(const std::string &pathData, const std::string &path_gg
 //   if (g_perf_stats)
 //      ntuple->PrintInfo(ROOT::Experimental::ENTupleInfo::kMetrics);
 
+   if (!g_result_path.empty())
+      WriteResult(hData, hCut);
    if (g_show)
       Show(hData, hggH, hVBF, hCut);
 
@@ -414,6 +481,10 @@ static TH1F * ProcessTree(TTree *tree, TH1D *hMass, bool isMC,
    tree->SetBranchAddress("scaleFactor_PhotonTRIGGER", &scaleFactor_PhotonTRIGGER, &brScaleFactorPhotonTrigger);
    tree->SetBranchAddress("scaleFactor_PILEUP", &scaleFactor_PILEUP, &brScaleFactorPileUp);
    tree->SetBranchAddress("mcWeight", &mcWeight, &brMcWeight);
+   g_tree_cache.Apply(tree, {brTrigP, brPhotonN, brPhotonIsTightId, brPhotonPt, brPhotonEta, brPhotonPhi, brPhotonE,
+                             brPhotonPtCone30, brPhotonEtCone20, brScaleFactorPhoton, brScaleFactorPhotonTrigger,
+                             brScaleFactorPileUp, brMcWeight});
+   g_tree_unzip.Apply(tree);
 
    auto nEntries = tree->GetEntries();
    std::chrono::steady_clock::time_point ts_first;
@@ -506,7 +577,11 @@ static void TreeDirect(const std::string &pathData, const std::string &path_ggH,
    auto hggH = new TH1D("", "Diphoton invariant mass; m_{#gamma#gamma} [GeV];Events", 30, 105, 160);
    auto hVBF = new TH1D("", "Diphoton invariant mass; m_{#gamma#gamma} [GeV];Events", 30, 105, 160);
 
-   auto file = TFile::Open(pathData.c_str());
+   g_tree_unzip.Enable();
+   std::unique_ptr<BlockCache> blockCache;
+   if (!g_block_cache_dir.empty())
+      blockCache.reset(new BlockCache(g_block_cache_dir, g_block_cache_limit));
+   auto file = CachedWebFile::Open(pathData, blockCache.get());
    auto tree = file->Get<TTree>("mini");
    TTreePerfStats *ps = nullptr;
    if (g_perf_stats)
@@ -514,8 +589,12 @@ static void TreeDirect(const std::string &pathData, const std::string &path_ggH,
    auto hCut = ProcessTree(tree, hData, false /* isMC */, &runtime_init, &runtime_analyze);
    std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
-   if (g_perf_stats)
+   if (blockCache)
+      blockCache->PrintStats();
+   if (g_perf_stats) {
       ps->Print();
+      TreeCacheConfig::PrintStats(tree);
+   }
 
 
 //   file = TFile::Open(path_ggH.c_str());
@@ -538,6 +617,8 @@ static void TreeDirect(const std::string &pathData, const std::string &path_ggH,
 //   if (g_perf_stats)
 //      ps->Print();
 
+   if (!g_result_path.empty())
+      WriteResult(hData, hCut);
    if (g_show)
       Show(hData, hggH, hVBF, hCut);
 
@@ -549,7 +630,10 @@ static void TreeDirect(const std::string &pathData, const std::string &path_ggH,
 
 
 static void Usage(const char *progname) {
-  printf("%s [-i gg_data.root] [-r(df)] [-m(t)] [-p(erformance stats)] [-s(show)]\n", progname);
+  printf("%s [-i gg_data.root] [-r(df)] [-m(t)] [-p(erformance stats)] [-s(show)] [-o result.root]\n"
+         "   [-C block cache directory[,size limit in MB] (TTree direct over HTTP only)]\n"
+         "   [-T tree cache size in MB[,fill] (TTree direct only)]\n"
+         "   [-Z unzip threads[,unzip budget in MB] (TTree direct only)]\n", progname);
 }
 
 
@@ -560,7 +644,7 @@ int main(int argc, char **argv) {
    std::string input_suffix;
    bool use_rdf = false;
    int c;
-   while ((c = getopt(argc, argv, "hvi:rpsm")) != -1) {
+   while ((c = getopt(argc, argv, "hvi:rpsmo:C:T:Z:")) != -1) {
       switch (c) {
       case 'h':
       case 'v':
@@ -581,6 +665,22 @@ int main(int argc, char **argv) {
       case 'r':
          use_rdf = true;
          break;
+      case 'o':
+         g_result_path = optarg;
+         break;
+      case 'C': {
+         auto cacheSpec = SplitString(optarg, ',');
+         g_block_cache_dir = cacheSpec[0];
+         if (cacheSpec.size() > 1)
+            g_block_cache_limit = String2Uint64(cacheSpec[1]) * 1024 * 1024;
+         break;
+      }
+      case 'T':
+         g_tree_cache = TreeCacheConfig::Parse(optarg);
+         break;
+      case 'Z':
+         g_tree_unzip = TreeUnzipConfig::Parse(optarg);
+         break;
       default:
          fprintf(stderr, "Unknown option: -%c\n", c);
          Usage(argv[0]);
@@ -591,6 +691,10 @@ int main(int argc, char **argv) {
       Usage(argv[0]);
       return 1;
    }
+   if (g_tree_cache.IsDisabled() && g_tree_unzip.IsSet()) {
+      fprintf(stderr, "-Z requires a tree cache, it cannot be combined with -T 0\n");
+      return 1;
+   }
 
    std::string suffix = GetSuffix(input_path);
    std::string compression = SplitString(StripSuffix(input_path), '~')[1];
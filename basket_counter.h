@@ -0,0 +1,65 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef BASKET_COUNTER_H_
+#define BASKET_COUNTER_H_
+
+#include <TBranch.h>
+#include <TMath.h>
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+/**
+ * Bookkeeping for the late materialization mode (-L) of the TTree direct analyses.  In this mode, the cheap cut
+ * branches are evaluated for all entries of a cluster first; the remaining branches are read only for the
+ * surviving entries, in entry order.  Only the cut branches go through the tree cache, so baskets of the late
+ * branches without surviving entries are never read or decompressed.  The counter records per late branch how
+ * many distinct baskets were touched.  Counting runs only in the -L mode, so that the default mode, which it is
+ * compared against, is timed without it; the default mode reports the total number of late baskets.
+ */
+class BasketCounter {
+   struct BranchInfo {
+      Long64_t fLastBasket = -1;
+      Long64_t fNRead = 0;
+   };
+   std::map<TBranch *, BranchInfo> fBranches;
+   bool fIsEnabled;
+
+public:
+   BasketCounter(bool isEnabled, const std::vector<TBranch *> &lateBranches) : fIsEnabled(isEnabled) {
+      for (auto b : lateBranches)
+         fBranches[b];
+   }
+
+   /// Records the basket of the branch entry without reading it; -L mode only
+   void Count(TBranch *branch, Long64_t entry) {
+      auto &info = fBranches[branch];
+      // The same lookup that TBranch::GetEntry() does to find the basket of the entry
+      Long64_t basket = TMath::BinarySearch(branch->GetWriteBasket() + 1, branch->GetBasketEntry(), entry);
+      if (basket != info.fLastBasket) {
+         info.fNRead++;
+         info.fLastBasket = basket;
+      }
+   }
+
+   void Print() const {
+      Long64_t nRead = 0;
+      Long64_t nTotal = 0;
+      for (const auto &b : fBranches) {
+         nRead += b.second.fNRead;
+         nTotal += b.first->GetWriteBasket();
+      }
+      if (!fIsEnabled) {
+         std::cout << "Late-Materialization: off, " << fBranches.size() << " late branches, " << nTotal
+                   << " baskets" << std::endl;
+         return;
+      }
+      std::cout << "Late-Materialization: on, " << fBranches.size() << " late branches, read " << nRead << " of "
+                << nTotal << " baskets, skipped " << (nTotal - nRead) << std::endl;
+   }
+};
+
+#endif  // BASKET_COUNTER_H_
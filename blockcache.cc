@@ -0,0 +1,163 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include "blockcache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+constexpr std::uint32_t BlockCache::kBlockSize;
+constexpr std::uint64_t BlockCache::kDefaultSizeLimit;
+
+namespace {
+
+/// FNV-1a, continued from hash
+std::uint64_t Hash(const void *buf, std::size_t size, std::uint64_t hash = 14695981039346656037ULL) {
+   auto bytes = reinterpret_cast<const unsigned char *>(buf);
+   for (std::size_t i = 0; i < size; ++i) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+const char *kBlockSuffix = ".blk";
+
+} // anonymous namespace
+
+
+BlockCache::BlockCache(const std::string &dir, std::uint64_t sizeLimit) : fDir(dir), fSizeLimit(sizeLimit) {
+   if ((mkdir(fDir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+      fprintf(stderr, "cannot create block cache directory %s: %s\n", fDir.c_str(), strerror(errno));
+      abort();
+   }
+   // Other processes may have filled the cache without reaching the eviction threshold
+   Evict();
+}
+
+
+std::uint64_t BlockCache::GetFileKey(const std::string &url, std::uint64_t size, const std::string &uuid) {
+   return Hash(uuid.data(), uuid.size(), Hash(&size, sizeof(size), Hash(url.data(), url.size())));
+}
+
+
+std::string BlockCache::GetBlockPath(std::uint64_t fileKey, std::uint64_t blockIdx) const {
+   char name[17];
+   snprintf(name, sizeof(name), "%016llx",
+            static_cast<unsigned long long>(Hash(&blockIdx, sizeof(blockIdx), fileKey)));
+   return fDir + "/" + name + kBlockSuffix;
+}
+
+
+bool BlockCache::Get(std::uint64_t fileKey, std::uint64_t blockIdx, std::size_t size, std::string *block) {
+   int fd = open(GetBlockPath(fileKey, blockIdx).c_str(), O_RDONLY);
+   if (fd < 0) {
+      fNMisses++;
+      return false;
+   }
+   struct stat info;
+   bool result = (fstat(fd, &info) == 0) && (static_cast<std::size_t>(info.st_size) == size);
+   if (result) {
+      block->resize(info.st_size);
+      result = (pread(fd, &(*block)[0], info.st_size, 0) == info.st_size);
+   }
+   // Marks the block as recently used
+   if (result)
+      futimens(fd, nullptr);
+   close(fd);
+   if (result) fNHits++; else fNMisses++;
+   if (!result)
+      block->clear();
+   return result;
+}
+
+
+void BlockCache::Put(std::uint64_t fileKey, std::uint64_t blockIdx, const char *data, std::size_t size) {
+   auto path = GetBlockPath(fileKey, blockIdx);
+   auto tmpPath = path + "." + std::to_string(getpid()) + ".tmp";
+   int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0)
+      return;
+   bool result = (write(fd, data, size) == static_cast<ssize_t>(size));
+   close(fd);
+   // A failed write, e.g. on a full disk, leaves the block uncached
+   if (!result || (rename(tmpPath.c_str(), path.c_str()) != 0)) {
+      unlink(tmpPath.c_str());
+      return;
+   }
+
+   fNBytesWritten += size;
+   if (fNBytesWritten > fSizeLimit / 16) {
+      Evict();
+      fNBytesWritten = 0;
+   }
+}
+
+
+void BlockCache::Evict() {
+   // Only one process scans the cache at a time; the others continue to fill it
+   auto lockPath = fDir + "/.lock";
+   int fdLock = open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+   if (fdLock < 0)
+      return;
+   if (flock(fdLock, LOCK_EX | LOCK_NB) != 0) {
+      close(fdLock);
+      return;
+   }
+
+   std::vector<std::pair<time_t, std::string>> blocks;
+   std::uint64_t size = 0;
+   DIR *dirp = opendir(fDir.c_str());
+   if (dirp) {
+      struct dirent *d;
+      while ((d = readdir(dirp)) != nullptr) {
+         std::string name = d->d_name;
+         if ((name.size() <= strlen(kBlockSuffix)) ||
+             (name.compare(name.size() - strlen(kBlockSuffix), std::string::npos, kBlockSuffix) != 0))
+         {
+            continue;
+         }
+         auto path = fDir + "/" + name;
+         struct stat info;
+         if (stat(path.c_str(), &info) != 0)
+            continue;
+         size += info.st_size;
+         blocks.emplace_back(info.st_mtime, path);
+      }
+      closedir(dirp);
+   }
+
+   if (size > fSizeLimit) {
+      std::sort(blocks.begin(), blocks.end());
+      for (const auto &b : blocks) {
+         if (size <= fSizeLimit / 10 * 9)
+            break;
+         struct stat info;
+         if ((stat(b.second.c_str(), &info) == 0) && (unlink(b.second.c_str()) == 0))
+            size -= std::min<std::uint64_t>(size, info.st_size);
+      }
+   }
+
+   flock(fdLock, LOCK_UN);
+   close(fdLock);
+}
+
+
+void BlockCache::PrintStats() const {
+   std::cout << "Block-Cache: " << fNHits << " hits, " << fNMisses << " misses of " << (kBlockSize / 1024)
+             << " kB blocks in " << fDir << std::endl;
+}
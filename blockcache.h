@@ -0,0 +1,53 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef BLOCKCACHE_H_
+#define BLOCKCACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * A local disk cache of fixed-size blocks of remote files.  A block is stored in its own file in the cache
+ * directory, named after a hash of the file identity (URL, size, and ROOT file UUID) and the block number, so that
+ * any number of processes can share the cache directory.  A rewritten file gets a new UUID and thus new blocks.
+ * Blocks are written to a temporary file and renamed into place, readers thus only see complete blocks; blocks of
+ * unexpected size are treated as misses.  The modification time of a block is updated on every hit.  When the cache
+ * grows beyond its size limit, the least recently used blocks are removed by the process that holds the eviction
+ * lock; the size is checked when the cache is opened and after every sizeLimit / 16 bytes written, so that many
+ * short runs keep the cache bounded, too.
+ */
+class BlockCache {
+public:
+   static constexpr std::uint32_t kBlockSize = 512 * 1024;
+   static constexpr std::uint64_t kDefaultSizeLimit = 16ULL * 1024 * 1024 * 1024;
+
+   explicit BlockCache(const std::string &dir, std::uint64_t sizeLimit = kDefaultSizeLimit);
+
+   /// Identifies a remote file by its URL, size, and the UUID that ROOT assigns to every newly written file
+   static std::uint64_t GetFileKey(const std::string &url, std::uint64_t size, const std::string &uuid);
+
+   /// Returns false if the block is not in the cache or if its size differs from the expected one
+   bool Get(std::uint64_t fileKey, std::uint64_t blockIdx, std::size_t size, std::string *block);
+   void Put(std::uint64_t fileKey, std::uint64_t blockIdx, const char *data, std::size_t size);
+
+   std::uint64_t GetNHits() const { return fNHits; }
+   std::uint64_t GetNMisses() const { return fNMisses; }
+   void PrintStats() const;
+
+private:
+   std::string GetBlockPath(std::uint64_t fileKey, std::uint64_t blockIdx) const;
+   /// Removes the least recently used blocks until the cache is below 90% of its size limit
+   void Evict();
+
+   std::string fDir;
+   std::uint64_t fSizeLimit;
+   /// Written since the last eviction run; the cache directory is scanned again after sizeLimit / 16 bytes
+   std::uint64_t fNBytesWritten = 0;
+   std::uint64_t fNHits = 0;
+   std::uint64_t fNMisses = 0;
+};
+
+#endif  // BLOCKCACHE_H_
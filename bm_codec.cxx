@@ -0,0 +1,718 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ *
+ * Compression codec micro-benchmark over the page payloads of a sample file.  For TTree input, the payloads are
+ * the uncompressed baskets of every branch.  For RNTuple input, the payloads are the packed column elements cut
+ * into pages of the same size the ntuple writer uses.  Every payload is compressed and decompressed with every
+ * requested codec and level; the results are reported per column, per column type, and per file.  Optionally, the
+ * pages are transformed by a pre-compression filter (see filter.h) before compression and restored after
+ * decompression, e.g. to measure the effect of byte shuffling.
+ */
+
+#include <ROOT/RField.hxx>
+#include <ROOT/RNTuple.hxx>
+#include <ROOT/RNTupleModel.hxx>
+
+#include <Compression.h>
+#include <RZip.h>
+#include <TBasket.h>
+#include <TBranch.h>
+#include <TBuffer.h>
+#include <TFile.h>
+#include <TLeaf.h>
+#include <TTree.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "filter.h"
+#include "policy.h"
+#include "util.h"
+
+// The maximum input size of a single R__zip call
+constexpr int kMaxZipBlock = 0xffffff;
+// RNTuple's default number of elements per page
+constexpr unsigned kDefaultElementsPerPage = 10000;
+
+struct Column {
+   std::string fName;
+   std::string fType;
+   std::vector<std::string> fPages;
+   std::size_t fElementSize = 1;
+   /// Tree baskets store big-endian values, so only byte shuffling is applicable to them
+   bool fIsNative = false;
+   ColumnFilter fFilter;
+};
+
+struct CodecResult {
+   std::uint64_t fNBytesRaw = 0;
+   std::uint64_t fNBytesZip = 0;
+   std::uint64_t fNanoZip = 0;
+   std::uint64_t fNanoUnzip = 0;
+
+   void Add(const CodecResult &other) {
+      fNBytesRaw += other.fNBytesRaw;
+      fNBytesZip += other.fNBytesZip;
+      fNanoZip += other.fNanoZip;
+      fNanoUnzip += other.fNanoUnzip;
+   }
+};
+
+
+/// The given field of /proc/self/status, e.g. "VmRSS" or "VmHWM" (the peak), in kiB; zero if it is not available
+static std::uint64_t GetProcStatusKiB(const std::string &field) {
+   std::ifstream status("/proc/self/status");
+   std::string line;
+   while (std::getline(status, line)) {
+      if (line.compare(0, field.size() + 1, field + ":") == 0)
+         return String2Uint64(SplitString(line.substr(field.size() + 1), 'k')[0]);
+   }
+   return 0;
+}
+
+
+/// Resets the peak resident set size to the current resident set size (Linux 4.0 and newer).  Returns false if the
+/// kernel does not support it, in which case the peak is the high-water mark of the entire process.
+static bool ResetPeakRss() {
+   std::ofstream clearRefs("/proc/self/clear_refs");
+   clearRefs << "5";
+   clearRefs.close();
+   return !clearRefs.fail();
+}
+
+
+/// The two letter algorithm tag of the header of a compressed block, as written by R__zipMultipleAlgorithm
+static const char *GetBlockTag(int compressionSettings) {
+   using EValues = ROOT::RCompressionSetting::EAlgorithm::EValues;
+   switch (static_cast<EValues>(compressionSettings / 100)) {
+   case EValues::kZLIB: return "ZL";
+   case EValues::kLZMA: return "XZ";
+   case EValues::kOldCompressionAlgo: return "CS";
+   case EValues::kLZ4: return "L4";
+   case EValues::kZSTD: return "ZS";
+   default: return "??";
+   }
+}
+
+
+/**
+ * Compresses the payload block by block, as TBasket and the RNTuple page sink do.  Returns the compressed size.  As
+ * in ROOT, a payload that does not compress is stored as is, so that a compressed size equal to the raw size marks
+ * an uncompressed payload and all blocks of a compressed payload carry a block header.
+ */
+static int Zip(int compressionSettings, const std::string &payload, char *zipBuffer) {
+   int nbytesZip = 0;
+   for (int offset = 0; offset < static_cast<int>(payload.size()); offset += kMaxZipBlock) {
+      int srcSize = std::min(kMaxZipBlock, static_cast<int>(payload.size()) - offset);
+      int tgtSize = srcSize;
+      int irep = 0;
+      R__zipMultipleAlgorithm(compressionSettings % 100, &srcSize, const_cast<char *>(payload.data()) + offset,
+                              &tgtSize, zipBuffer + nbytesZip, &irep,
+                              static_cast<ROOT::RCompressionSetting::EAlgorithm::EValues>(compressionSettings / 100));
+      if (irep == 0 || nbytesZip + irep >= static_cast<int>(payload.size())) {
+         memcpy(zipBuffer, payload.data(), payload.size());
+         return payload.size();
+      }
+      nbytesZip += irep;
+   }
+   return nbytesZip;
+}
+
+
+static void Unzip(int compressionSettings, const char *zipBuffer, int nbytesZip, char *target, int nbytesRaw) {
+   if (nbytesZip == nbytesRaw) {
+      memcpy(target, zipBuffer, nbytesRaw);
+      return;
+   }
+   auto tag = GetBlockTag(compressionSettings);
+   int offsetZip = 0;
+   int offsetRaw = 0;
+   while (offsetZip < nbytesZip) {
+      int srcSize = 0;
+      int tgtSize = 0;
+      auto src = reinterpret_cast<unsigned char *>(const_cast<char *>(zipBuffer)) + offsetZip;
+      // The block header starts with the algorithm tag followed by the method byte
+      if (src[0] != tag[0] || src[1] != tag[1] || R__unzip_header(&srcSize, src, &tgtSize) != 0) {
+         fprintf(stderr, "invalid block header (%c%c, method %d) at offset %d, expected %s\n",
+                 src[0], src[1], src[2], offsetZip, tag);
+         abort();
+      }
+      int irep = 0;
+      R__unzip(&srcSize, src, &tgtSize, reinterpret_cast<unsigned char *>(target) + offsetRaw, &irep);
+      assert(irep == tgtSize);
+      offsetZip += srcSize;
+      offsetRaw += tgtSize;
+   }
+   assert(offsetRaw == nbytesRaw);
+}
+
+
+template <typename T>
+static void DeltaPage(std::string *page, bool encode) {
+   auto values = reinterpret_cast<T *>(&(*page)[0]);
+   if (encode)
+      DeltaEncode(values, page->size() / sizeof(T));
+   else
+      DeltaDecode(values, page->size() / sizeof(T));
+}
+
+
+static void DeltaPage(std::string *page, std::size_t elementSize, bool encode) {
+   switch (elementSize) {
+   case 1: DeltaPage<std::int8_t>(page, encode); break;
+   case 2: DeltaPage<std::int16_t>(page, encode); break;
+   case 4: DeltaPage<std::int32_t>(page, encode); break;
+   case 8: DeltaPage<std::int64_t>(page, encode); break;
+   default: assert(false);
+   }
+}
+
+
+/// Applies the reversible part of the column filter (delta, shuffle) to the page, using scratch as a work buffer
+static void EncodePage(const Column &column, std::string *page, std::string *scratch) {
+   if (column.fFilter.fDelta)
+      DeltaPage(page, column.fElementSize, true);
+   if (column.fFilter.fShuffle) {
+      scratch->resize(page->size());
+      ByteShuffle(reinterpret_cast<const unsigned char *>(page->data()), page->size(), column.fElementSize,
+                  reinterpret_cast<unsigned char *>(&(*scratch)[0]));
+      page->swap(*scratch);
+   }
+}
+
+
+static void DecodePage(const Column &column, std::string *page, std::string *scratch) {
+   if (column.fFilter.fShuffle) {
+      scratch->resize(page->size());
+      ByteUnshuffle(reinterpret_cast<const unsigned char *>(page->data()), page->size(), column.fElementSize,
+                    reinterpret_cast<unsigned char *>(&(*scratch)[0]));
+      page->swap(*scratch);
+   }
+   if (column.fFilter.fDelta)
+      DeltaPage(page, column.fElementSize, false);
+}
+
+
+/// Processes every nThreads-th page of all columns, starting with page threadIdx
+static void RunCodec(const std::vector<Column> &columns, int compressionSettings,
+                     unsigned threadIdx, unsigned nThreads, std::vector<CodecResult> *results)
+{
+   std::vector<char> zipBuffer;
+   std::string filterBuffer;
+   std::string unzipBuffer;
+   std::string scratch;
+   unsigned pageIdx = 0;
+   for (unsigned c = 0; c < columns.size(); ++c) {
+      const bool hasFilter = columns[c].fFilter.fDelta || columns[c].fFilter.fShuffle;
+      for (const auto &page : columns[c].fPages) {
+         if ((pageIdx++ % nThreads) != threadIdx)
+            continue;
+         // The compressed data must fit, with some slack for the block headers of incompressible data
+         zipBuffer.resize(page.size() + page.size() / 10 + 512);
+         unzipBuffer.resize(page.size());
+
+         // The filter is part of the (de-)compression time
+         auto tsZip = std::chrono::steady_clock::now();
+         const std::string *zipInput = &page;
+         if (hasFilter) {
+            filterBuffer.assign(page);
+            EncodePage(columns[c], &filterBuffer, &scratch);
+            zipInput = &filterBuffer;
+         }
+         int nbytesZip = Zip(compressionSettings, *zipInput, zipBuffer.data());
+         auto tsUnzip = std::chrono::steady_clock::now();
+         Unzip(compressionSettings, zipBuffer.data(), nbytesZip, &unzipBuffer[0], page.size());
+         if (hasFilter)
+            DecodePage(columns[c], &unzipBuffer, &scratch);
+         auto tsEnd = std::chrono::steady_clock::now();
+
+         if (memcmp(unzipBuffer.data(), page.data(), page.size()) != 0) {
+            std::cerr << "round-trip failure in column " << columns[c].fName << " for compression "
+                      << compressionSettings << std::endl;
+            abort();
+         }
+
+         auto &r = (*results)[c];
+         r.fNBytesRaw += page.size();
+         r.fNBytesZip += nbytesZip;
+         r.fNanoZip += std::chrono::duration_cast<std::chrono::nanoseconds>(tsUnzip - tsZip).count();
+         r.fNanoUnzip += std::chrono::duration_cast<std::chrono::nanoseconds>(tsEnd - tsUnzip).count();
+      }
+   }
+}
+
+
+static void ExtractBranch(TBranch *branch, std::uint64_t maxBytes, std::vector<Column> *columns) {
+   auto subBranches = branch->GetListOfBranches();
+   if (subBranches && subBranches->GetEntries() > 0) {
+      for (auto b : TRangeDynCast<TBranch>(*subBranches))
+         ExtractBranch(b, maxBytes, columns);
+      return;
+   }
+
+   Column column;
+   column.fName = branch->GetName();
+   auto leaf = static_cast<TLeaf *>(branch->GetListOfLeaves()->First());
+   column.fType = leaf ? leaf->GetTypeName() : "unknown";
+   if (leaf && leaf->GetLeafCount())
+      column.fType = std::string("[]") + column.fType;
+   if (leaf)
+      column.fElementSize = leaf->GetLenType();
+
+   std::uint64_t nbytes = 0;
+   for (int i = 0; i < branch->GetWriteBasket() && nbytes < maxBytes; ++i) {
+      auto basket = branch->GetBasket(i);
+      if (!basket)
+         continue;
+      const char *payload = basket->GetBufferRef()->Buffer() + basket->GetKeylen();
+      column.fPages.emplace_back(payload, basket->GetObjlen());
+      nbytes += basket->GetObjlen();
+   }
+   columns->emplace_back(std::move(column));
+}
+
+
+static std::vector<Column> ExtractTree(const std::string &path, const std::string &treeName, std::uint64_t maxBytes) {
+   std::vector<Column> columns;
+   std::unique_ptr<TFile> file(TFile::Open(path.c_str()));
+   assert(file && !file->IsZombie());
+   auto tree = file->Get<TTree>(treeName.c_str());
+   for (auto b : TRangeDynCast<TBranch>(*tree->GetListOfBranches()))
+      ExtractBranch(b, maxBytes, &columns);
+   return columns;
+}
+
+
+/// Collects the packed elements of a column into pages of elementsPerPage elements.  As in the page sink, bool
+/// elements are bit-packed, eight per byte.
+class PageCollector {
+   Column fColumn;
+   unsigned fElementsPerPage;
+   unsigned fNElements = 0;
+   std::uint64_t fNBytes = 0;
+   std::string fPage;
+
+   void Commit() {
+      if (++fNElements == fElementsPerPage)
+         Flush();
+   }
+
+public:
+   PageCollector(const Column &column, unsigned elementsPerPage) : fColumn(column), fElementsPerPage(elementsPerPage)
+   {}
+   void Append(const void *element, std::size_t size) {
+      fPage.append(reinterpret_cast<const char *>(element), size);
+      fNBytes += size;
+      Commit();
+   }
+   void AppendBit(bool value) {
+      if (fNElements % 8 == 0) {
+         fPage.push_back(0);
+         fNBytes++;
+      }
+      if (value)
+         fPage.back() = static_cast<char>(fPage.back() | (1 << (fNElements % 8)));
+      Commit();
+   }
+   void Flush() {
+      if (fNElements == 0)
+         return;
+      fColumn.fPages.emplace_back(std::move(fPage));
+      fPage.clear();
+      fNElements = 0;
+   }
+   std::uint64_t GetNBytes() const { return fNBytes; }
+   Column &GetColumn() { return fColumn; }
+};
+
+
+/// Appends the column elements of a field, including its subfields, at the given index of the field's index space
+using Sampler_t = std::function<void(std::uint64_t index)>;
+
+/**
+ * Builds the samplers of the fields of an ntuple.  Classes are split into their members and collections into an
+ * offset column and the columns of their items, recursively, so that every column of the ntuple is sampled.
+ */
+class NTupleSampler {
+   using RFieldBase = ROOT::Experimental::Detail::RFieldBase;
+
+   ROOT::Experimental::RNTupleReader *fNTuple;
+   unsigned fElementsPerPage;
+   std::map<const RFieldBase *, std::vector<const RFieldBase *>> fSubFields;
+   /// A deque keeps the collectors in place as more are added
+   std::deque<PageCollector> fCollectors;
+
+   PageCollector *AddCollector(const std::string &name, const std::string &type, std::size_t elementSize,
+                               bool isItem)
+   {
+      fCollectors.emplace_back(Column{name, isItem ? "[]" + type : type, {}, elementSize, true, {}},
+                               fElementsPerPage);
+      return &fCollectors.back();
+   }
+
+   template <typename T>
+   Sampler_t MakeLeafSampler(const std::string &name, const std::string &type, bool isItem) {
+      auto view = std::make_shared<ROOT::Experimental::RNTupleView<T>>(fNTuple->GetView<T>(name));
+      auto collector = AddCollector(name, type, sizeof(T), isItem);
+      return [view, collector](std::uint64_t index) {
+         T value = (*view)(index);
+         collector->Append(&value, sizeof(T));
+      };
+   }
+
+   std::vector<Sampler_t> MakeSubSamplers(const RFieldBase *field, bool isItem) {
+      std::vector<Sampler_t> samplers;
+      for (auto f : fSubFields[field])
+         samplers.emplace_back(MakeSampler(f, isItem));
+      return samplers;
+   }
+
+public:
+   NTupleSampler(ROOT::Experimental::RNTupleReader *ntuple, unsigned elementsPerPage)
+      : fNTuple(ntuple), fElementsPerPage(elementsPerPage)
+   {
+      // The field iterator visits all fields depth-first
+      for (const auto &f : *ntuple->GetModel()->GetFieldZero())
+         fSubFields[f.GetParent()].emplace_back(&f);
+   }
+
+   std::vector<Sampler_t> MakeTopLevelSamplers() {
+      return MakeSubSamplers(fNTuple->GetModel()->GetFieldZero(), false);
+   }
+
+   Sampler_t MakeSampler(const RFieldBase *field, bool isItem) {
+      using ENTupleStructure = ROOT::Experimental::ENTupleStructure;
+      const auto name = field->GetName();
+      const auto type = field->GetType();
+
+      if (field->GetStructure() == ENTupleStructure::kRecord) {
+         // A class has no columns of its own; its members share its index space
+         auto memberSamplers = MakeSubSamplers(field, isItem);
+         return [memberSamplers](std::uint64_t index) {
+            for (const auto &s : memberSamplers)
+               s(index);
+         };
+      }
+      if (field->GetStructure() == ENTupleStructure::kCollection) {
+         auto view = std::make_shared<ROOT::Experimental::RNTupleViewCollection>(fNTuple->GetViewCollection(name));
+         auto offsets = AddCollector(name + "[offsets]", "std::uint32_t", sizeof(std::uint32_t), isItem);
+         auto itemSamplers = MakeSubSamplers(field, true);
+         std::uint32_t offset = 0;
+         return [view, offsets, itemSamplers, offset](std::uint64_t index) mutable {
+            for (auto i : view->GetCollectionRange(index)) {
+               for (const auto &s : itemSamplers)
+                  s(i);
+               ++offset;
+            }
+            offsets->Append(&offset, sizeof(offset));
+         };
+      }
+
+      if (type == "bool") {
+         auto view = std::make_shared<ROOT::Experimental::RNTupleView<bool>>(fNTuple->GetView<bool>(name));
+         auto collector = AddCollector(name, type, sizeof(bool), isItem);
+         return [view, collector](std::uint64_t index) { collector->AppendBit((*view)(index)); };
+      }
+      if (type == "std::string") {
+         auto view = std::make_shared<ROOT::Experimental::RNTupleView<std::string>>(
+            fNTuple->GetView<std::string>(name));
+         auto offsets = AddCollector(name + "[offsets]", "std::uint32_t", sizeof(std::uint32_t), isItem);
+         auto chars = AddCollector(name, "char", sizeof(char), true);
+         std::uint32_t offset = 0;
+         return [view, offsets, chars, offset](std::uint64_t index) mutable {
+            const auto value = (*view)(index);
+            for (auto c : value)
+               chars->Append(&c, sizeof(c));
+            offset += value.size();
+            offsets->Append(&offset, sizeof(offset));
+         };
+      }
+      if (type == "float") return MakeLeafSampler<float>(name, type, isItem);
+      if (type == "double") return MakeLeafSampler<double>(name, type, isItem);
+      if (type == "std::int32_t") return MakeLeafSampler<std::int32_t>(name, type, isItem);
+      if (type == "std::uint32_t") return MakeLeafSampler<std::uint32_t>(name, type, isItem);
+      if (type == "std::int64_t") return MakeLeafSampler<std::int64_t>(name, type, isItem);
+      if (type == "std::uint64_t") return MakeLeafSampler<std::uint64_t>(name, type, isItem);
+      if (type == "std::uint8_t") return MakeLeafSampler<std::uint8_t>(name, type, isItem);
+      if (type == "unsigned char") return MakeLeafSampler<unsigned char>(name, type, isItem);
+
+      std::cout << "Skipping field " << name << " [" << type << "]" << std::endl;
+      return [](std::uint64_t) {};
+   }
+
+   std::uint64_t GetMaxNBytes() const {
+      std::uint64_t maxNBytes = 0;
+      for (const auto &c : fCollectors)
+         maxNBytes = std::max(maxNBytes, c.GetNBytes());
+      return maxNBytes;
+   }
+
+   std::vector<Column> ReleaseColumns() {
+      std::vector<Column> columns;
+      for (auto &c : fCollectors) {
+         c.Flush();
+         columns.emplace_back(std::move(c.GetColumn()));
+      }
+      fCollectors.clear();
+      return columns;
+   }
+};
+
+
+static std::vector<Column> ExtractNTuple(const std::string &path, const std::string &ntupleName,
+                                         unsigned elementsPerPage, std::uint64_t maxBytes)
+{
+   auto ntuple = ROOT::Experimental::RNTupleReader::Open(ntupleName, path);
+   NTupleSampler sampler(ntuple.get(), elementsPerPage);
+   auto fieldSamplers = sampler.MakeTopLevelSamplers();
+
+   for (auto i : ntuple->GetEntryRange()) {
+      for (const auto &s : fieldSamplers)
+         s(i);
+      // All columns are sampled from the same entry range, until the largest column reaches the limit
+      if (sampler.GetMaxNBytes() >= maxBytes)
+         break;
+   }
+   return sampler.ReleaseColumns();
+}
+
+
+static std::string GetTypeClass(const std::string &type) {
+   if (type.compare(0, 2, "[]") == 0)
+      return GetTypeClass(type.substr(2));
+   if (type == "float" || type == "Float_t" || type == "double" || type == "Double_t")
+      return "float";
+   if (type == "bool" || type == "Bool_t")
+      return "bool";
+   if (type.find("int") != std::string::npos || type.find("Int") != std::string::npos ||
+       type.find("Long") != std::string::npos || type == "unsigned char" || type == "UChar_t")
+   {
+      return "int";
+   }
+   return "other";
+}
+
+
+/// Drops the parts of the filter that are not applicable to the column and truncates the floating point values
+static void SetFilter(const ColumnFilter &filter, Column *column) {
+   auto typeClass = GetTypeClass(column->fType);
+   column->fFilter = filter;
+   column->fFilter.fShuffle = filter.fShuffle && (column->fElementSize > 1);
+   column->fFilter.fDelta = filter.fDelta && column->fIsNative && (typeClass == "int");
+   column->fFilter.fMantissaBits = (column->fIsNative && typeClass == "float") ? filter.fMantissaBits : 0;
+   if (column->fFilter.fMantissaBits == 0)
+      return;
+
+   // Truncation is lossy; the truncated values become the reference for the round-trip check
+   for (auto &page : column->fPages) {
+      if (column->fElementSize == sizeof(float)) {
+         auto values = reinterpret_cast<float *>(&page[0]);
+         for (std::size_t i = 0; i < page.size() / sizeof(float); ++i)
+            values[i] = TruncateMantissa(values[i], column->fFilter.fMantissaBits);
+      } else {
+         auto values = reinterpret_cast<double *>(&page[0]);
+         for (std::size_t i = 0; i < page.size() / sizeof(double); ++i)
+            values[i] = TruncateMantissa(values[i], column->fFilter.fMantissaBits);
+      }
+   }
+}
+
+
+static void PrintResult(const std::string &name, const std::string &codec, unsigned nThreads,
+                        const CodecResult &r, std::uint64_t wallNanoZip, std::uint64_t wallNanoUnzip)
+{
+   // With multiple threads, the throughput is determined by the wall clock time rather than the summed time
+   auto nanoZip = (wallNanoZip > 0) ? wallNanoZip : r.fNanoZip;
+   auto nanoUnzip = (wallNanoUnzip > 0) ? wallNanoUnzip : r.fNanoUnzip;
+   printf("%-40s %-6s %2u %12llu %12llu %8.3f %10.1f %10.1f\n",
+          name.c_str(), codec.c_str(), nThreads,
+          static_cast<unsigned long long>(r.fNBytesRaw), static_cast<unsigned long long>(r.fNBytesZip),
+          (r.fNBytesZip > 0) ? static_cast<double>(r.fNBytesRaw) / r.fNBytesZip : 0.0,
+          (nanoZip > 0) ? r.fNBytesRaw * 1000.0 / nanoZip : 0.0,
+          (nanoUnzip > 0) ? r.fNBytesRaw * 1000.0 / nanoUnzip : 0.0);
+}
+
+
+static void Usage(const char *progname) {
+   printf("%s -i <input.root/ntuple> -n <tree/ntuple name> [-c codecs (default zlib,lz4,lzma,zstd)]\n"
+          "   [-l levels (default 1,5,9)] [-t threads (default 1)] [-e elements per page (ntuple)]\n"
+          "   [-m max MiB per column] [-C(olumn results)] [-f filter (e.g. shuffle+delta+trunc16)]\n"
+          "   [-P compression policy with per-column filters]\n", progname);
+}
+
+
+int main(int argc, char **argv) {
+   std::string inputPath;
+   std::string name;
+   std::vector<std::string> codecs{"zlib", "lz4", "lzma", "zstd"};
+   std::vector<std::string> levels{"1", "5", "9"};
+   std::vector<unsigned> nThreadsList{1};
+   unsigned elementsPerPage = kDefaultElementsPerPage;
+   std::uint64_t maxBytes = std::uint64_t(-1);
+   bool perColumn = false;
+   ColumnFilter defaultFilter;
+   std::string policyPath;
+
+   int c;
+   while ((c = getopt(argc, argv, "hvi:n:c:l:t:e:m:Cf:P:")) != -1) {
+      switch (c) {
+      case 'h':
+      case 'v':
+         Usage(argv[0]);
+         return 0;
+      case 'i':
+         inputPath = optarg;
+         break;
+      case 'n':
+         name = optarg;
+         break;
+      case 'c':
+         codecs = SplitString(optarg, ',');
+         break;
+      case 'l':
+         levels = SplitString(optarg, ',');
+         break;
+      case 't':
+         nThreadsList.clear();
+         for (const auto &t : SplitString(optarg, ','))
+            nThreadsList.emplace_back(String2Uint64(t));
+         break;
+      case 'e':
+         elementsPerPage = String2Uint64(optarg);
+         break;
+      case 'm':
+         maxBytes = String2Uint64(optarg) * 1024 * 1024;
+         break;
+      case 'C':
+         perColumn = true;
+         break;
+      case 'f':
+         defaultFilter = ParseColumnFilter(optarg);
+         break;
+      case 'P':
+         policyPath = optarg;
+         break;
+      default:
+         fprintf(stderr, "Unknown option: -%c\n", c);
+         Usage(argv[0]);
+         return 1;
+      }
+   }
+   if (inputPath.empty() || name.empty()) {
+      Usage(argv[0]);
+      return 1;
+   }
+
+   std::vector<Column> columns;
+   auto suffix = GetSuffix(inputPath);
+   switch (GetFileFormat(suffix)) {
+   case FileFormats::kRoot:
+      columns = ExtractTree(inputPath, name, maxBytes);
+      break;
+   case FileFormats::kNtuple:
+      columns = ExtractNTuple(inputPath, name, elementsPerPage, maxBytes);
+      break;
+   default:
+      std::cerr << "Invalid file format: " << suffix << std::endl;
+      return 1;
+   }
+   // The codecs are given by -c and -l
+   CompressionPolicy policy(0);
+   if (!policyPath.empty())
+      policy = CompressionPolicy::Load(policyPath, 0);
+   for (auto &col : columns) {
+      ColumnFilter filter = defaultFilter;
+      if (!policyPath.empty()) {
+         policy.Resolve(col.fName, &filter);
+         if (filter.IsEmpty())
+            filter = defaultFilter;
+      }
+      SetFilter(filter, &col);
+      if (!col.fFilter.IsEmpty())
+         std::cout << "Filter " << col.fFilter.ToString() << " for column " << col.fName << std::endl;
+   }
+
+   std::uint64_t nPages = 0;
+   for (const auto &col : columns)
+      nPages += col.fPages.size();
+   std::cout << "Extracted " << nPages << " pages from " << columns.size() << " columns" << std::endl;
+   std::cout << "RSS after extraction: " << GetProcStatusKiB("VmRSS") << "kiB" << std::endl;
+   const bool hasPeakReset = ResetPeakRss();
+   if (!hasPeakReset)
+      std::cout << "Cannot reset the peak RSS, the per-codec memory is the process high-water mark" << std::endl;
+
+   printf("# %-38s %-6s %2s %12s %12s %8s %10s %10s\n",
+          "column", "codec", "NT", "raw[B]", "zip[B]", "ratio", "zip[MB/s]", "unzip[MB/s]");
+   for (const auto &codec : codecs) {
+      for (const auto &level : levels) {
+         auto compressionSettings = GetCompressionSettings(codec) / 100 * 100 + String2Uint64(level);
+         auto codecName = codec + "-" + level;
+         for (auto nThreads : nThreadsList) {
+            std::vector<std::vector<CodecResult>> threadResults(nThreads, std::vector<CodecResult>(columns.size()));
+            std::vector<std::thread> threads;
+            // The extracted pages are resident throughout, so the codec memory is the growth of the peak beyond
+            // them: the per-thread page buffers plus the codec's working buffers
+            auto rssBaseline = GetProcStatusKiB("VmRSS");
+            ResetPeakRss();
+            auto tsStart = std::chrono::steady_clock::now();
+            for (unsigned t = 0; t < nThreads; ++t) {
+               threads.emplace_back(RunCodec, std::cref(columns), compressionSettings, t, nThreads,
+                                    &threadResults[t]);
+            }
+            for (auto &t : threads)
+               t.join();
+            auto tsEnd = std::chrono::steady_clock::now();
+
+            std::vector<CodecResult> columnResults(columns.size());
+            for (const auto &r : threadResults) {
+               for (unsigned i = 0; i < columns.size(); ++i)
+                  columnResults[i].Add(r[i]);
+            }
+
+            std::map<std::string, CodecResult> typeResults;
+            CodecResult total;
+            for (unsigned i = 0; i < columns.size(); ++i) {
+               if (perColumn && nThreads == 1)
+                  PrintResult(columns[i].fName, codecName, nThreads, columnResults[i], 0, 0);
+               typeResults[GetTypeClass(columns[i].fType)].Add(columnResults[i]);
+               total.Add(columnResults[i]);
+            }
+            for (const auto &t : typeResults)
+               PrintResult("@type:" + t.first, codecName, nThreads, t.second, 0, 0);
+
+            // For the multi-threaded case, the wall clock time covers compression and decompression together;
+            // it is split according to the ratio of the summed per-thread times
+            std::uint64_t wallNanoZip = 0;
+            std::uint64_t wallNanoUnzip = 0;
+            if (nThreads > 1 && (total.fNanoZip + total.fNanoUnzip) > 0) {
+               auto wallNano = std::chrono::duration_cast<std::chrono::nanoseconds>(tsEnd - tsStart).count();
+               wallNanoZip = wallNano * total.fNanoZip / (total.fNanoZip + total.fNanoUnzip);
+               wallNanoUnzip = wallNano - wallNanoZip;
+            }
+            PrintResult("@total", codecName, nThreads, total, wallNanoZip, wallNanoUnzip);
+            auto rssPeak = GetProcStatusKiB("VmHWM");
+            printf("# RSS %s %u threads: +%llukiB peak over the extracted pages%s\n", codecName.c_str(), nThreads,
+                   static_cast<unsigned long long>((rssPeak > rssBaseline) ? (rssPeak - rssBaseline) : 0),
+                   hasPeakReset ? "" : " (process high-water mark)");
+         }
+      }
+   }
+
+   return 0;
+}
@@ -0,0 +1,141 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef CACHEDWEBFILE_H_
+#define CACHEDWEBFILE_H_
+
+#include <TFile.h>
+#include <TWebFile.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "blockcache.h"
+
+/**
+ * An HTTP file whose reads are served from a local block cache.  Requests are split into the blocks of the cache;
+ * the missing blocks of a request are fetched from the server in a single vectored read and stored in the cache.
+ * TTree reads through a tree cache arrive as vectored reads, too, so that a cold run needs no more round trips than
+ * a run without the block cache.
+ */
+class CachedWebFile : public TWebFile {
+   BlockCache *fBlockCache;
+   std::uint64_t fFileKey;
+   Long64_t fFileSize;
+   /// Set while fetching from the server, in case the base class falls back to the single buffer read
+   bool fIsFetching = false;
+
+   /// The size of block blockIdx; the last block of the file is shorter
+   Long64_t GetBlockSize(std::uint64_t blockIdx) const {
+      return std::min<Long64_t>(BlockCache::kBlockSize, fFileSize - blockIdx * BlockCache::kBlockSize);
+   }
+
+   /// Looks up the blocks of [pos, pos + len) in the block cache; blocks not in the cache or of the wrong size
+   /// remain empty and are fetched again
+   void LookupBlocks(Long64_t pos, Int_t len, std::map<std::uint64_t, std::string> *blocks) {
+      for (auto b = pos / BlockCache::kBlockSize; b <= (pos + len - 1) / BlockCache::kBlockSize; ++b) {
+         if (blocks->count(b) > 0)
+            continue;
+         fBlockCache->Get(fFileKey, b, GetBlockSize(b), &(*blocks)[b]);
+      }
+   }
+
+   /// Fills the empty blocks from the server, stores them in the cache and copies the requested ranges to buf
+   Bool_t Serve(char *buf, Long64_t *pos, Int_t *len, Int_t nbuf) {
+      std::map<std::uint64_t, std::string> blocks;
+      for (Int_t i = 0; i < nbuf; ++i) {
+         if (len[i] > 0)
+            LookupBlocks(pos[i], len[i], &blocks);
+      }
+
+      std::vector<Long64_t> missPos;
+      std::vector<Int_t> missLen;
+      for (const auto &b : blocks) {
+         if (!b.second.empty())
+            continue;
+         missPos.push_back(b.first * BlockCache::kBlockSize);
+         missLen.push_back(GetBlockSize(b.first));
+      }
+      if (!missPos.empty()) {
+         Long64_t missSize = 0;
+         for (auto l : missLen)
+            missSize += l;
+         std::string missBuf(missSize, '\0');
+         fIsFetching = true;
+         auto failed = TWebFile::ReadBuffers(&missBuf[0], missPos.data(), missLen.data(), missPos.size());
+         fIsFetching = false;
+         if (failed)
+            return kTRUE;
+         Long64_t offset = 0;
+         for (std::size_t i = 0; i < missPos.size(); ++i) {
+            auto blockIdx = missPos[i] / BlockCache::kBlockSize;
+            blocks[blockIdx].assign(missBuf.data() + offset, missLen[i]);
+            fBlockCache->Put(fFileKey, blockIdx, missBuf.data() + offset, missLen[i]);
+            offset += missLen[i];
+         }
+      }
+
+      // The requested ranges are copied one after the other into buf, as by TFile::ReadBuffers()
+      Long64_t offset = 0;
+      for (Int_t i = 0; i < nbuf; ++i) {
+         Long64_t p = pos[i];
+         Long64_t remaining = len[i];
+         while (remaining > 0) {
+            auto blockIdx = p / BlockCache::kBlockSize;
+            const auto &block = blocks[blockIdx];
+            Long64_t inBlock = p - blockIdx * BlockCache::kBlockSize;
+            Long64_t n = std::min<Long64_t>(remaining, static_cast<Long64_t>(block.size()) - inBlock);
+            if (n <= 0)
+               return kTRUE;
+            memcpy(buf + offset, block.data() + inBlock, n);
+            offset += n;
+            p += n;
+            remaining -= n;
+         }
+      }
+      return kFALSE;
+   }
+
+public:
+   /// The file header, which includes the UUID of the file, is read by TWebFile directly, bypassing the cache
+   CachedWebFile(const char *url, BlockCache *blockCache)
+      : TWebFile(url), fBlockCache(blockCache), fFileKey(0), fFileSize(GetSize())
+   {
+      fFileKey = BlockCache::GetFileKey(url, fFileSize, GetUUID().AsString());
+   }
+
+   /// HTTP URLs are read through the block cache, if there is one; everything else is opened by TFile::Open()
+   static TFile *Open(const std::string &path, BlockCache *blockCache) {
+      bool isHttp = (path.compare(0, 7, "http://") == 0) || (path.compare(0, 8, "https://") == 0);
+      if (blockCache && isHttp)
+         return new CachedWebFile(path.c_str(), blockCache);
+      return TFile::Open(path.c_str());
+   }
+
+   Bool_t ReadBuffer(char *buf, Int_t len) override {
+      if (fIsFetching)
+         return TWebFile::ReadBuffer(buf, len);
+      return ReadBuffer(buf, fOffset, len);
+   }
+
+   Bool_t ReadBuffer(char *buf, Long64_t pos, Int_t len) override {
+      if (fIsFetching)
+         return TWebFile::ReadBuffer(buf, pos, len);
+      auto failed = Serve(buf, &pos, &len, 1);
+      SetOffset(pos + len);
+      return failed;
+   }
+
+   Bool_t ReadBuffers(char *buf, Long64_t *pos, Int_t *len, Int_t nbuf) override {
+      if (fIsFetching)
+         return TWebFile::ReadBuffers(buf, pos, len, nbuf);
+      return Serve(buf, pos, len, nbuf);
+   }
+};
+
+#endif  // CACHEDWEBFILE_H_
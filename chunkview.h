@@ -0,0 +1,189 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef CHUNKVIEW_H_
+#define CHUNKVIEW_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "decodepool.h"
+#include "shmcache.h"
+
+/**
+ * The partition of the entries into chunks.  Without clusters, chunks have a fixed size of kChunkSize entries.  With
+ * the first entries of the clusters given, every cluster is split into chunks of at most kChunkSize entries, so that
+ * no chunk spans two clusters.  With the default page size of the generators, the chunks of a flat column then
+ * coincide with its pages.
+ */
+class ChunkLayout {
+   /// The first entry of every chunk, followed by the number of entries
+   std::vector<std::uint64_t> fBoundaries;
+
+public:
+   static constexpr std::uint64_t kChunkSize = ShmChunkCache::kChunkSize;
+
+   ChunkLayout(std::uint64_t nEntries, const std::vector<std::uint64_t> &clusterStarts = {}) {
+      auto starts = clusterStarts;
+      if (starts.empty() || starts[0] != 0)
+         starts.insert(starts.begin(), 0);
+      starts.push_back(nEntries);
+      for (std::size_t c = 0; c + 1 < starts.size(); ++c) {
+         for (auto first = starts[c]; first < starts[c + 1]; first += kChunkSize)
+            fBoundaries.push_back(first);
+      }
+      fBoundaries.push_back(nEntries);
+   }
+
+   std::uint64_t GetNChunks() const { return fBoundaries.size() - 1; }
+   std::uint64_t GetFirst(std::uint64_t chunkIdx) const { return fBoundaries[chunkIdx]; }
+   std::uint64_t GetNEntries(std::uint64_t chunkIdx) const {
+      return fBoundaries[chunkIdx + 1] - fBoundaries[chunkIdx];
+   }
+   /// The chunk of the entry, found by binary search
+   std::uint64_t FindChunk(std::uint64_t index) const {
+      return std::upper_bound(fBoundaries.begin(), fBoundaries.end(), index) - fBoundaries.begin() - 1;
+   }
+};
+
+
+/**
+ * Reads a column chunk-wise, with the chunks coming from one of two sources.  With a chunk cache, the first access
+ * to an entry of a chunk maps the chunk from the cache or, on a miss, decodes the chunk through the underlying view
+ * into the cache.  With a decode pool, the chunks are decoded on the pool threads ahead of the analysis thread.  Every
+ * column keeps one chunk more in flight than there are pool threads, so that the chunks of the current cluster are
+ * decompressed in parallel.  Queued chunks that the analysis skips, e.g. because of a zone map, are cancelled.
+ * Without either source, the view is read directly.
+ */
+template <typename T, typename ViewT>
+class ChunkView {
+public:
+   /// Decodes the entries [first, first + n) of the column on the pool thread threadId
+   using PoolDecodeFunc_t = std::function<void(unsigned threadId, std::uint64_t first, std::uint64_t n, T *values)>;
+
+private:
+   struct PendingChunk {
+      std::uint64_t fChunkIdx;
+      std::shared_ptr<std::vector<T>> fValues;
+      DecodePool::Ticket fTicket;
+   };
+
+   ViewT fView;
+   std::string fColumn;
+   std::shared_ptr<const ChunkLayout> fLayout;
+   ShmChunkCache *fCache = nullptr;
+   std::uint64_t fFileKey = 0;
+   DecodePool *fPool = nullptr;
+   PoolDecodeFunc_t fPoolDecode;
+   /// Chunks in flight on the decode pool, including the one the analysis waits for
+   std::uint64_t fReadAhead = 0;
+   std::deque<PendingChunk> fPending;
+   /// The entries [fChunkFirst, fChunkEnd) of the current chunk
+   std::uint64_t fChunkFirst = 0;
+   std::uint64_t fChunkEnd = 0;
+   const T *fChunk = nullptr;
+   /// Holds the chunk if it is not in the cache
+   std::vector<T> fPrivate;
+
+   void SubmitChunk(std::uint64_t chunkIdx) {
+      PendingChunk pending;
+      pending.fChunkIdx = chunkIdx;
+      pending.fValues = std::make_shared<std::vector<T>>(fLayout->GetNEntries(chunkIdx));
+      auto values = pending.fValues;
+      auto first = fLayout->GetFirst(chunkIdx);
+      auto fnDecode = fPoolDecode;
+      pending.fTicket = fPool->Submit([values, first, fnDecode](unsigned threadId) {
+         fnDecode(threadId, first, values->size(), values->data());
+      });
+      fPending.emplace_back(std::move(pending));
+   }
+
+   void CancelFront() {
+      fPool->Cancel(fPending.front().fTicket);
+      fPending.pop_front();
+   }
+
+   void LoadPoolChunk(std::uint64_t chunkIdx) {
+      // Chunks skipped by the analysis are cancelled; those that already started still hold their buffers
+      while (!fPending.empty() && fPending.front().fChunkIdx < chunkIdx)
+         CancelFront();
+      if (fPending.empty() || fPending.front().fChunkIdx != chunkIdx) {
+         while (!fPending.empty())
+            CancelFront();
+         SubmitChunk(chunkIdx);
+      }
+      auto nChunks = fLayout->GetNChunks();
+      for (auto next = fPending.back().fChunkIdx + 1; next < std::min(chunkIdx + fReadAhead, nChunks); ++next)
+         SubmitChunk(next);
+
+      fPool->Wait(&fPending.front().fTicket);
+      fPrivate = std::move(*fPending.front().fValues);
+      fPending.pop_front();
+      fChunk = fPrivate.data();
+   }
+
+   void LoadCacheChunk(std::uint64_t chunkIdx) {
+      auto first = fLayout->GetFirst(chunkIdx);
+      auto n = fLayout->GetNEntries(chunkIdx);
+      auto fnDecode = [&](void *buf) {
+         auto values = static_cast<T *>(buf);
+         for (std::uint64_t i = 0; i < n; ++i)
+            values[i] = fView(first + i);
+      };
+
+      auto key = ShmChunkCache::GetChunkKey(fFileKey, chunkIdx, fColumn);
+      std::uint64_t size;
+      auto chunk = fCache->Get(key, &size);
+      if (!chunk)
+         chunk = fCache->Insert(key, n * sizeof(T), fnDecode);
+      if (!chunk) {
+         fPrivate.resize(n);
+         fnDecode(fPrivate.data());
+         chunk = fPrivate.data();
+      }
+      fChunk = static_cast<const T *>(chunk);
+   }
+
+public:
+   ChunkView(ViewT &&view, const std::string &column, std::uint64_t nEntries)
+      : fView(std::move(view)), fColumn(column), fLayout(std::make_shared<ChunkLayout>(nEntries)) {}
+
+   /// The cache keys chunks by their number, hence it uses the fixed-size chunks
+   void SetCache(ShmChunkCache *cache, std::uint64_t fileKey) {
+      fCache = cache;
+      fFileKey = fileKey;
+   }
+
+   /// The layout should follow the clusters, so that no chunk needs the pages of two clusters
+   void SetPool(DecodePool *pool, const PoolDecodeFunc_t &poolDecode, std::shared_ptr<const ChunkLayout> layout) {
+      fPool = pool;
+      fPoolDecode = poolDecode;
+      fLayout = layout;
+      fReadAhead = pool->GetNThreads() + 1;
+   }
+
+   T operator()(std::uint64_t index) {
+      if (!fCache && !fPool)
+         return fView(index);
+      if ((index < fChunkFirst) || (index >= fChunkEnd)) {
+         auto chunkIdx = fLayout->FindChunk(index);
+         if (fPool)
+            LoadPoolChunk(chunkIdx);
+         else
+            LoadCacheChunk(chunkIdx);
+         fChunkFirst = fLayout->GetFirst(chunkIdx);
+         fChunkEnd = fChunkFirst + fLayout->GetNEntries(chunkIdx);
+      }
+      return fChunk[index - fChunkFirst];
+   }
+};
+
+#endif  // CHUNKVIEW_H_
@@ -14,13 +14,18 @@
 #include <TH1D.h>
 #include <TFile.h>
 #include <TLatex.h>
+#include <TLeaf.h>
 #include <TStyle.h>
 #include <TSystem.h>
 #include <TTreePerfStats.h>
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <future>
 #include <iostream>
 #include <memory>
@@ -28,10 +33,27 @@
 #include <vector>
 #include <utility>
 
+#include "blockcache.h"
+#include "cachedwebfile.h"
+#include "numa.h"
+#include "slotmonitor.h"
+#include "treecache.h"
 #include "util.h"
+#include "workstealing.h"
 
 bool g_perf_stats = false;
 bool g_show = false;
+std::string g_result_path;
+std::string g_block_cache_dir;
+std::uint64_t g_block_cache_limit = BlockCache::kDefaultSizeLimit;
+TreeCacheConfig g_tree_cache;
+TreeUnzipConfig g_tree_unzip;
+bool g_slot_balance = false;
+unsigned g_n_threads = 0;
+bool g_numa_placement = false;
+
+/// Stolen clusters are split down to ranges of this many entries
+constexpr std::uint64_t kMinRangeSize = 1000;
 
 //static ROOT::Experimental::RNTupleReadOptions GetRNTupleOptions() {
 //   using RNTupleReadOptions = ROOT::Experimental::RNTupleReadOptions;
@@ -75,35 +97,128 @@ static void Show(TH1D *h) {
    }
 }
 
+static void WriteResult(TH1D *h) {
+   std::unique_ptr<TFile> f(TFile::Open(g_result_path.c_str(), "RECREATE"));
+   if (!f || f->IsZombie()) {
+      fprintf(stderr, "cannot write result file %s\n", g_result_path.c_str());
+      abort();
+   }
+   f->WriteTObject(h, "Dimuon_mass");
+   f->Close();
+   std::cout << "Wrote histograms to " << g_result_path << std::endl;
+}
+
+/**
+ * Buffer for a variable-size array branch, sized once from the largest value of its leaf count in the tree.  Reading
+ * any entry of the branch then fits without reallocation.
+ */
+template <typename T>
+static std::vector<T> MakeArrayBuffer(TTree *tree, const char *branchName) {
+   auto leaf = tree->GetLeaf(branchName);
+   if (!leaf) {
+      fprintf(stderr, "no leaf %s in tree %s\n", branchName, tree->GetName());
+      abort();
+   }
+   auto leafCount = leaf->GetLeafCount();
+   Int_t maxElements = leafCount ? leafCount->GetMaximum() : 1;
+   return std::vector<T>(std::max(maxElements, 1) * leaf->GetLenStatic());
+}
+
+/// The invariant mass of the first two muons
+static float GetDimuonMass(const float *pt, const float *eta, const float *phi, const float *mass) {
+   float x_sum = 0.;
+   float y_sum = 0.;
+   float z_sum = 0.;
+   float e_sum = 0.;
+   for (std::size_t i = 0u; i < 2; ++i) {
+      // Convert to (e, x, y, z) coordinate system and update sums
+      const auto x = pt[i] * std::cos(phi[i]);
+      x_sum += x;
+      const auto y = pt[i] * std::sin(phi[i]);
+      y_sum += y;
+      const auto z = pt[i] * std::sinh(eta[i]);
+      z_sum += z;
+      const auto e = std::sqrt(x * x + y * y + z * z + mass[i] * mass[i]);
+      e_sum += e;
+   }
+   // Return invariant mass with (+, -, -, -) metric
+   return std::sqrt(e_sum * e_sum - x_sum * x_sum - y_sum * y_sum - z_sum * z_sum);
+}
+
+
+/**
+ * The muon branches and the buffers they are read into, shared by TreeDirect and the workers of TreeDirectMT
+ */
+class DimuonTreeEvent {
+   unsigned int fNMuons = 0;
+   std::vector<int> fMuonCharge;
+   std::vector<float> fMuonPhi;
+   std::vector<float> fMuonPt;
+   std::vector<float> fMuonEta;
+   std::vector<float> fMuonMass;
+   TBranch *fBrNMuons = nullptr;
+   TBranch *fBrMuonCharge = nullptr;
+   TBranch *fBrMuonPhi = nullptr;
+   TBranch *fBrMuonPt = nullptr;
+   TBranch *fBrMuonEta = nullptr;
+   TBranch *fBrMuonMass = nullptr;
+
+public:
+   explicit DimuonTreeEvent(TTree *tree)
+      : fMuonCharge(MakeArrayBuffer<int>(tree, "Muon_charge"))
+      , fMuonPhi(MakeArrayBuffer<float>(tree, "Muon_phi"))
+      , fMuonPt(MakeArrayBuffer<float>(tree, "Muon_pt"))
+      , fMuonEta(MakeArrayBuffer<float>(tree, "Muon_eta"))
+      , fMuonMass(MakeArrayBuffer<float>(tree, "Muon_mass"))
+   {
+      tree->SetBranchAddress("nMuon", &fNMuons, &fBrNMuons);
+      tree->SetBranchAddress("Muon_charge", fMuonCharge.data(), &fBrMuonCharge);
+      tree->SetBranchAddress("Muon_phi", fMuonPhi.data(), &fBrMuonPhi);
+      tree->SetBranchAddress("Muon_pt", fMuonPt.data(), &fBrMuonPt);
+      tree->SetBranchAddress("Muon_eta", fMuonEta.data(), &fBrMuonEta);
+      tree->SetBranchAddress("Muon_mass", fMuonMass.data(), &fBrMuonMass);
+   }
+   DimuonTreeEvent(const DimuonTreeEvent &) = delete;
+   DimuonTreeEvent &operator=(const DimuonTreeEvent &) = delete;
+
+   std::vector<TBranch *> GetBranches() const {
+      return {fBrNMuons, fBrMuonCharge, fBrMuonPhi, fBrMuonPt, fBrMuonEta, fBrMuonMass};
+   }
+
+   /// The dimuon cuts; fills the invariant mass of entries with two muons of opposite charge
+   void Fill(Long64_t entryId, TH1D *hMass) {
+      fBrNMuons->GetEntry(entryId);
+      if (fNMuons != 2)
+         return;
+      fBrMuonCharge->GetEntry(entryId);
+      if (fMuonCharge[0] == fMuonCharge[1])
+         return;
+
+      fBrMuonPhi->GetEntry(entryId);
+      fBrMuonPt->GetEntry(entryId);
+      fBrMuonEta->GetEntry(entryId);
+      fBrMuonMass->GetEntry(entryId);
+      hMass->Fill(GetDimuonMass(fMuonPt.data(), fMuonEta.data(), fMuonPhi.data(), fMuonMass.data()));
+   }
+};
+
+
 static void TreeDirect(const std::string &path) {
    auto ts_init = std::chrono::steady_clock::now();
+   g_tree_unzip.Enable();
 
-   auto file = TFile::Open(path.c_str());
+   std::unique_ptr<BlockCache> blockCache;
+   if (!g_block_cache_dir.empty())
+      blockCache.reset(new BlockCache(g_block_cache_dir, g_block_cache_limit));
+   auto file = CachedWebFile::Open(path, blockCache.get());
    auto tree = file->Get<TTree>("Events");
    TTreePerfStats *ps = nullptr;
    if (g_perf_stats)
       ps = new TTreePerfStats("ioperf", tree);
 
-   unsigned int nMuons;
-   TBranch *br_nMuons;
-   tree->SetBranchAddress("nMuon", &nMuons, &br_nMuons);
-
-   int Muon_charge[2];
-   TBranch *br_MuonCharge;
-   tree->SetBranchAddress("Muon_charge", &Muon_charge, &br_MuonCharge);
-
-   float Muon_phi[2];
-   TBranch *br_MuonPhi;
-   tree->SetBranchAddress("Muon_phi", &Muon_phi, &br_MuonPhi);
-   float Muon_pt[2];
-   TBranch *br_MuonPt;
-   tree->SetBranchAddress("Muon_pt", &Muon_pt, &br_MuonPt);
-   float Muon_eta[2];
-   TBranch *br_MuonEta;
-   tree->SetBranchAddress("Muon_eta", &Muon_eta, &br_MuonEta);
-   float Muon_mass[2];
-   TBranch *br_MuonMass;
-   tree->SetBranchAddress("Muon_mass", &Muon_mass, &br_MuonMass);
+   DimuonTreeEvent event(tree);
+   g_tree_cache.Apply(tree, event.GetBranches());
+   g_tree_unzip.Apply(tree);
 
    auto hMass = new TH1D("Dimuon_mass", "Dimuon_mass", 2000, 0.25, 300);
 
@@ -117,47 +232,114 @@ static void TreeDirect(const std::string &path) {
       }
 
       tree->LoadTree(entryId);
+      event.Fill(entryId, hMass);
+   }
 
-      br_nMuons->GetEntry(entryId);
-      if (nMuons != 2)
-         continue;
-      br_MuonCharge->GetEntry(entryId);
-      if (Muon_charge[0] == Muon_charge[1])
-         continue;
+   auto ts_end = std::chrono::steady_clock::now();
+   auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
+   auto runtime_analyze = std::chrono::duration_cast<std::chrono::microseconds>(ts_end - ts_first).count();
 
-      br_MuonPhi->GetEntry(entryId);
-      br_MuonPt->GetEntry(entryId);
-      br_MuonEta->GetEntry(entryId);
-      br_MuonMass->GetEntry(entryId);
-      float x_sum = 0.;
-      float y_sum = 0.;
-      float z_sum = 0.;
-      float e_sum = 0.;
-      for (std::size_t i = 0u; i < 2; ++i) {
-         // Convert to (e, x, y, z) coordinate system and update sums
-         const auto x = Muon_pt[i] * std::cos(Muon_phi[i]);
-         x_sum += x;
-         const auto y = Muon_pt[i] * std::sin(Muon_phi[i]);
-         y_sum += y;
-         const auto z = Muon_pt[i] * std::sinh(Muon_eta[i]);
-         z_sum += z;
-         const auto e = std::sqrt(x * x + y * y + z * z + Muon_mass[i] * Muon_mass[i]);
-         e_sum += e;
+   std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
+   std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
+   if (blockCache)
+      blockCache->PrintStats();
+   if (g_perf_stats) {
+      ps->Print();
+      TreeCacheConfig::PrintStats(tree);
+   }
+
+   if (!g_result_path.empty())
+      WriteResult(hMass);
+   if (g_show)
+      Show(hMass);
+   delete hMass;
+}
+
+
+/**
+ * A worker of the multi-threaded TTree direct analysis (-t) with its own file, tree, branch buffers, and histogram.
+ */
+class DimuonTreeWorker {
+   std::unique_ptr<TFile> fFile;
+   TTree *fTree;
+   DimuonTreeEvent fEvent;
+   std::unique_ptr<TH1D> fHMass;
+
+public:
+   DimuonTreeWorker(const std::string &path, unsigned workerId)
+      : fFile(TFile::Open(path.c_str())), fTree(fFile->Get<TTree>("Events")), fEvent(fTree)
+   {
+      g_tree_cache.Apply(fTree, fEvent.GetBranches());
+
+      auto name = "Dimuon_mass_" + std::to_string(workerId);
+      fHMass.reset(new TH1D(name.c_str(), "Dimuon_mass", 2000, 0.25, 300));
+      fHMass->SetDirectory(nullptr);
+   }
+
+   TTree *GetTree() const { return fTree; }
+   const TH1D *GetHMass() const { return fHMass.get(); }
+
+   /// Reads the baskets of the first cluster of a stolen range in one go
+   void Prefetch(const WorkStealingScheduler::Range &range) {
+      fTree->LoadTree(range.fFirst);
+      auto cache = fTree->GetReadCache(fTree->GetCurrentFile());
+      if (cache)
+         cache->FillBuffer();
+   }
+
+   void Process(const WorkStealingScheduler::Range &range) {
+      for (auto entryId = range.fFirst; entryId < range.fLast; ++entryId) {
+         fTree->LoadTree(entryId);
+         fEvent.Fill(entryId, fHMass.get());
       }
-      // Return invariant mass with (+, -, -, -) metric
-      auto mass = std::sqrt(e_sum * e_sum - x_sum * x_sum - y_sum * y_sum - z_sum * z_sum);
-      hMass->Fill(mass);
    }
+};
+
+
+/**
+ * The clusters of the tree are scheduled on g_n_threads workers by the work-stealing scheduler.  The workers open
+ * their files on their own threads, i.e. after they have been pinned with NUMA placement (-N).
+ */
+static void TreeDirectMT(const std::string &path) {
+   using Range = WorkStealingScheduler::Range;
 
+   auto ts_init = std::chrono::steady_clock::now();
+   ROOT::EnableThreadSafety();
+   NumaPlacement placement(g_numa_placement);
+
+   std::vector<Range> clusters;
+   std::unique_ptr<TFile> file(TFile::Open(path.c_str()));
+   auto tree = file->Get<TTree>("Events");
+   auto nEntries = tree->GetEntries();
+   auto clusterItr = tree->GetClusterIterator(0);
+   Long64_t clusterStart;
+   while ((clusterStart = clusterItr.Next()) < nEntries)
+      clusters.emplace_back(Range{static_cast<std::uint64_t>(clusterStart),
+                                  static_cast<std::uint64_t>(clusterItr.GetNextEntry())});
+
+   std::vector<std::unique_ptr<DimuonTreeWorker>> workers(g_n_threads);
+   WorkStealingScheduler scheduler(g_n_threads, kMinRangeSize, &placement);
+   scheduler.Run(clusters,
+      [&workers, &path](unsigned workerId) { workers[workerId].reset(new DimuonTreeWorker(path, workerId)); },
+      [&workers](unsigned workerId, const Range &range) { workers[workerId]->Process(range); },
+      [&workers](unsigned workerId, const Range &range) { workers[workerId]->Prefetch(range); });
+
+   auto hMass = new TH1D("Dimuon_mass", "Dimuon_mass", 2000, 0.25, 300);
+   for (const auto &w : workers)
+      hMass->Add(w->GetHMass());
+
+   auto ts_first = scheduler.GetTsReady();
    auto ts_end = std::chrono::steady_clock::now();
    auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
    auto runtime_analyze = std::chrono::duration_cast<std::chrono::microseconds>(ts_end - ts_first).count();
 
    std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
-   if (g_perf_stats)
-      ps->Print();
+   placement.Print();
+   scheduler.PrintStats();
 
+   if (!g_result_path.empty())
+      WriteResult(hMass);
    if (g_show)
       Show(hMass);
    delete hMass;
@@ -245,6 +427,8 @@ static void NTupleDirect(const std::string &path) {
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
    if (g_perf_stats)
       ntuple->PrintInfo(ENTupleInfo::kMetrics);
+   if (!g_result_path.empty())
+      WriteResult(hMass);
    if (g_show)
       Show(hMass);
 }
@@ -299,17 +483,19 @@ static T InvariantMassStdVector(std::vector<T>& pt, std::vector<T>& eta, std::ve
 //}
 
 
+/// The number of RDataFrame processing slots
+static unsigned GetNSlots() {
+   return ROOT::IsImplicitMTEnabled() ? ROOT::GetImplicitMTPoolSize() : 1;
+}
+
+
 static void TreeRdf(const std::string &path) {
    auto ts_init = std::chrono::steady_clock::now();
-   std::chrono::steady_clock::time_point ts_first;
-   bool ts_first_set = false;
 
    ROOT::RDataFrame df("Events", path);
-   auto df_timing = df.Define("TIMING", [&ts_first, &ts_first_set]() {
-      if (!ts_first_set)
-         ts_first = std::chrono::steady_clock::now();
-      ts_first_set = true;
-      return ts_first_set;}).Filter([](bool b){ return b; }, {"TIMING"});
+   SlotMonitor monitor(GetNSlots(), g_slot_balance);
+   auto df_timing = df.Filter([&monitor](unsigned int slot, ULong64_t entry) { return monitor.Tick(slot, entry); },
+                              {"rdfslot_", "rdfentry_"});
    auto df_2mu = df_timing.Filter([](unsigned int s) { return s == 2; }, {"nMuon"});
    auto df_os = df_2mu.Filter([](const ROOT::VecOps::RVec<int> &c) {return c[0] != c[1];}, {"Muon_charge"});
    //auto df_os = df_2mu.Filter("Muon_charge[0] != Muon_charge[1]");
@@ -319,18 +505,30 @@ static void TreeRdf(const std::string &path) {
 
    *hMass;
    auto ts_end = std::chrono::steady_clock::now();
+   auto ts_first = monitor.GetTsFirst();
    auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
    auto runtime_analyze = std::chrono::duration_cast<std::chrono::microseconds>(ts_end - ts_first).count();
 
    std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
+   monitor.Print(ts_end);
+   // The implicit MT threads are not pinned; reported like the -t and -U runners
+   NumaPlacement(false).Print();
+   if (!g_result_path.empty())
+      WriteResult(hMass.GetPtr());
    if (g_show)
       Show(hMass.GetPtr());
 }
 
 
 static void Usage(const char *progname) {
-  printf("%s [-i input.root/ntuple] [-r(df)] [-m(t)] [-s(show)] [-p(erformance stats)]\n", progname);
+  printf("%s [-i input.root/ntuple] [-r(df)] [-m(t)] [-s(show)] [-p(erformance stats)] [-o result.root]\n"
+         "   [-C block cache directory[,size limit in MB] (TTree direct over HTTP only)]\n"
+         "   [-T tree cache size in MB[,fill] (TTree direct only)]\n"
+         "   [-b(alance report per processing slot, rdf only)]\n"
+         "   [-t threads of the work-stealing cluster scheduler (TTree direct only)]\n"
+         "   [-N(UMA placement of the -t workers)]\n"
+         "   [-Z unzip threads[,unzip budget in MB] (TTree direct only)]\n", progname);
 }
 
 int main(int argc, char **argv) {
@@ -339,7 +537,7 @@ int main(int argc, char **argv) {
    bool use_rdf = false;
    std::string path;
    int c;
-   while ((c = getopt(argc, argv, "hvsrpmi:")) != -1) {
+   while ((c = getopt(argc, argv, "hvsrpmi:o:C:T:Z:bt:N")) != -1) {
       switch (c) {
       case 'h':
       case 'v':
@@ -348,9 +546,21 @@ int main(int argc, char **argv) {
       case 'i':
          path = optarg;
          break;
+      case 'o':
+         g_result_path = optarg;
+         break;
       case 'r':
          use_rdf = true;
          break;
+      case 'b':
+         g_slot_balance = true;
+         break;
+      case 't':
+         g_n_threads = String2Uint64(optarg);
+         break;
+      case 'N':
+         g_numa_placement = true;
+         break;
       case 'p':
          g_perf_stats = true;
          break;
@@ -360,6 +570,19 @@ int main(int argc, char **argv) {
       case 'm':
          ROOT::EnableImplicitMT();
          break;
+      case 'C': {
+         auto cacheSpec = SplitString(optarg, ',');
+         g_block_cache_dir = cacheSpec[0];
+         if (cacheSpec.size() > 1)
+            g_block_cache_limit = String2Uint64(cacheSpec[1]) * 1024 * 1024;
+         break;
+      }
+      case 'T':
+         g_tree_cache = TreeCacheConfig::Parse(optarg);
+         break;
+      case 'Z':
+         g_tree_unzip = TreeUnzipConfig::Parse(optarg);
+         break;
       default:
          fprintf(stderr, "Unknown option: -%c\n", c);
          Usage(argv[0]);
@@ -370,14 +593,34 @@ int main(int argc, char **argv) {
       Usage(argv[0]);
       return 1;
    }
+   if (g_numa_placement && (g_n_threads == 0)) {
+      fprintf(stderr, "-N requires -t\n");
+      return 1;
+   }
+   if (g_tree_cache.IsDisabled() && g_tree_unzip.IsSet()) {
+      fprintf(stderr, "-Z requires a tree cache, it cannot be combined with -T 0\n");
+      return 1;
+   }
+   // The workers open their files directly; the shared unzip pool would compete with the pinned workers
+   if ((g_n_threads > 0) && (!g_block_cache_dir.empty() || g_perf_stats || g_tree_unzip.IsSet())) {
+      fprintf(stderr, "-t cannot be combined with -C, -p, or -Z\n");
+      return 1;
+   }
 
    auto suffix = GetSuffix(path);
+   if ((g_n_threads > 0) && (use_rdf || (GetFileFormat(suffix) != FileFormats::kRoot))) {
+      fprintf(stderr, "-t requires the TTree direct path\n");
+      return 1;
+   }
    switch (GetFileFormat(suffix)) {
    case FileFormats::kRoot:
       if (use_rdf) {
          TreeRdf(path);
       } else {
-         TreeDirect(path);
+         if (g_n_threads > 0)
+            TreeDirectMT(path);
+         else
+            TreeDirect(path);
       }
       break;
    case FileFormats::kNtuple:
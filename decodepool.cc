@@ -0,0 +1,126 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include "decodepool.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+DecodePool::DecodePool(unsigned nThreads, const NumaPlacement *placement, unsigned node)
+   : fPlacement(placement)
+   , fNode(node)
+   , fQueues(nThreads)
+   , fConditions(nThreads)
+   , fTsStart(std::chrono::steady_clock::now())
+{
+   for (unsigned i = 0; i < nThreads; ++i)
+      fThreads.emplace_back(&DecodePool::Work, this, i);
+}
+
+
+DecodePool::~DecodePool() {
+   {
+      std::lock_guard<std::mutex> guard(fLock);
+      fIsStopping = true;
+      for (auto &q : fQueues)
+         q.clear();
+   }
+   for (auto &c : fConditions)
+      c.notify_all();
+   for (auto &t : fThreads)
+      t.join();
+}
+
+
+DecodePool::Ticket DecodePool::Submit(const Task_t &task) {
+   Ticket ticket;
+   std::packaged_task<void(unsigned)> packagedTask(task);
+   ticket.fDone = packagedTask.get_future();
+   {
+      std::lock_guard<std::mutex> guard(fLock);
+      auto nThreads = fQueues.size();
+      unsigned threadId = fNextThread;
+      for (unsigned i = 1; i < nThreads; ++i) {
+         auto candidate = (fNextThread + i) % nThreads;
+         if (fQueues[candidate].size() < fQueues[threadId].size())
+            threadId = candidate;
+      }
+      fNextThread = (threadId + 1) % nThreads;
+      ticket.fId = fNextId++;
+      ticket.fThreadId = threadId;
+      fQueues[threadId].emplace_back(QueuedTask{ticket.fId, std::move(packagedTask)});
+   }
+   fConditions[ticket.fThreadId].notify_one();
+   return ticket;
+}
+
+
+void DecodePool::Cancel(const Ticket &ticket) {
+   std::lock_guard<std::mutex> guard(fLock);
+   auto &queue = fQueues[ticket.fThreadId];
+   auto itr = std::find_if(queue.begin(), queue.end(),
+                           [&ticket](const QueuedTask &t) { return t.fId == ticket.fId; });
+   if (itr == queue.end())
+      return;
+   queue.erase(itr);
+   fNCancelled++;
+}
+
+
+void DecodePool::Wait(Ticket *ticket) {
+   auto &done = ticket->fDone;
+   fNWaits++;
+   if (done.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      auto ts_start = std::chrono::steady_clock::now();
+      done.wait();
+      fTimeStalled += std::chrono::steady_clock::now() - ts_start;
+      fNStalls++;
+   }
+   done.get();
+}
+
+
+void DecodePool::Work(unsigned threadId) {
+   if (fPlacement)
+      fPlacement->PinThread(fNode);
+   auto &queue = fQueues[threadId];
+   while (true) {
+      std::packaged_task<void(unsigned)> task;
+      {
+         std::unique_lock<std::mutex> lock(fLock);
+         fConditions[threadId].wait(lock, [this, &queue]{ return fIsStopping || !queue.empty(); });
+         if (fIsStopping)
+            return;
+         task = std::move(queue.front().fTask);
+         queue.pop_front();
+      }
+
+      auto ts_start = std::chrono::steady_clock::now();
+      task(threadId);
+      std::chrono::nanoseconds latency = std::chrono::steady_clock::now() - ts_start;
+
+      std::lock_guard<std::mutex> guard(fLock);
+      fNTasks++;
+      fTimeBusy += latency;
+      fTimeMaxTask = std::max(fTimeMaxTask, latency);
+   }
+}
+
+
+void DecodePool::PrintStats() const {
+   using std::chrono::duration_cast;
+   using std::chrono::microseconds;
+
+   std::chrono::nanoseconds timeWall = std::chrono::steady_clock::now() - fTsStart;
+   std::lock_guard<std::mutex> guard(fLock);
+   auto nTasks = std::max<std::uint64_t>(fNTasks, 1);
+   auto utilization = 100. * fTimeBusy.count() / std::max<double>(timeWall.count() * fThreads.size(), 1.);
+   std::cout << "Decode-Pool: " << fThreads.size() << " threads, " << fNTasks << " column chunks decoded, "
+             << fNCancelled << " cancelled, latency per column chunk "
+             << duration_cast<microseconds>(fTimeBusy).count() / nTasks
+             << "us mean / " << duration_cast<microseconds>(fTimeMaxTask).count() << "us max, utilization "
+             << utilization << "%, analysis stalled on " << fNStalls << " of " << fNWaits << " chunks for "
+             << duration_cast<microseconds>(fTimeStalled).count() << "us" << std::endl;
+}
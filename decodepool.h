@@ -0,0 +1,86 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef DECODEPOOL_H_
+#define DECODEPOOL_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "numa.h"
+
+/**
+ * A fixed set of threads that decode column chunks ahead of the analysis thread.  Every thread has its own queue; a
+ * submitted task goes to the thread with the shortest queue, so that the chunks of a single cluster, of all columns,
+ * are decoded in parallel.  A task receives the number of the thread that runs it, so that it can use per-thread
+ * readers.  Queued tasks can be cancelled as long as they did not start.  The pool records the decoding latency of
+ * every chunk, the time the analysis thread waits for decoded chunks, and the utilization of the pool threads.  With placement, the pool
+ * threads are pinned to the given NUMA node, typically the node of the analysis thread that consumes the chunks.
+ */
+class DecodePool {
+public:
+   using Task_t = std::function<void(unsigned threadId)>;
+
+   /// A submitted task, to be waited for or cancelled
+   struct Ticket {
+      std::uint64_t fId = 0;
+      unsigned fThreadId = 0;
+      std::future<void> fDone;
+   };
+
+   explicit DecodePool(unsigned nThreads, const NumaPlacement *placement = nullptr, unsigned node = 0);
+   DecodePool(const DecodePool &other) = delete;
+   DecodePool &operator =(const DecodePool &other) = delete;
+   /// Queued tasks that did not start are dropped
+   ~DecodePool();
+
+   unsigned GetNThreads() const { return fThreads.size(); }
+   /// Queues the task for the pool thread with the fewest queued tasks
+   Ticket Submit(const Task_t &task);
+   /// Removes the task from its queue unless it already started; the future of a cancelled task is never ready
+   void Cancel(const Ticket &ticket);
+   /// Waits for a submitted task on the analysis thread and records the stall
+   void Wait(Ticket *ticket);
+   void PrintStats() const;
+
+private:
+   struct QueuedTask {
+      std::uint64_t fId;
+      std::packaged_task<void(unsigned)> fTask;
+   };
+
+   void Work(unsigned threadId);
+
+   const NumaPlacement *fPlacement;
+   unsigned fNode;
+   std::vector<std::thread> fThreads;
+   mutable std::mutex fLock;
+   /// One queue and one condition variable per thread
+   std::vector<std::deque<QueuedTask>> fQueues;
+   std::vector<std::condition_variable> fConditions;
+   std::uint64_t fNextId = 0;
+   /// Ties between equally short queues are broken round-robin
+   unsigned fNextThread = 0;
+   bool fIsStopping = false;
+
+   std::chrono::steady_clock::time_point fTsStart;
+   // Protected by fLock
+   std::uint64_t fNTasks = 0;
+   std::uint64_t fNCancelled = 0;
+   std::chrono::nanoseconds fTimeBusy{0};
+   std::chrono::nanoseconds fTimeMaxTask{0};
+   // Only touched by the analysis thread
+   std::uint64_t fNWaits = 0;
+   std::uint64_t fNStalls = 0;
+   std::chrono::nanoseconds fTimeStalled{0};
+};
+
+#endif  // DECODEPOOL_H_
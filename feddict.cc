@@ -0,0 +1,152 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include "feddict.h"
+
+#include <zdict.h>
+#include <zstd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+// Below this number of samples, ZDICT_trainFromBuffer() fails or produces useless dictionaries
+static constexpr std::size_t kMinSamples = 8;
+
+FedDictionaries::~FedDictionaries() {
+   for (auto &d : fDictionaries) {
+      ZSTD_freeCDict(d.second.fCDict);
+      ZSTD_freeDDict(d.second.fDDict);
+   }
+   ZSTD_freeCCtx(fCCtx);
+   ZSTD_freeDCtx(fDCtx);
+}
+
+
+void FedDictionaries::AddSample(const std::vector<Blob> &event) {
+   for (unsigned i = 0; i < event.size(); ++i) {
+      if (event[i].empty())
+         continue;
+      fSamples[i].append(reinterpret_cast<const char *>(event[i].data()), event[i].size());
+      fSampleSizes[i].push_back(event[i].size());
+   }
+}
+
+
+void FedDictionaries::Train(std::size_t dictSize, int compressionLevel) {
+   fCompressionLevel = compressionLevel;
+   std::string buffer(dictSize, '\0');
+   for (const auto &s : fSamples) {
+      const auto &sizes = fSampleSizes[s.first];
+      if (sizes.size() < kMinSamples)
+         continue;
+      auto size = ZDICT_trainFromBuffer(&buffer[0], buffer.size(), s.second.data(), sizes.data(), sizes.size());
+      if (ZDICT_isError(size))
+         continue;
+      Insert(s.first, buffer.substr(0, size));
+   }
+   fSamples.clear();
+   fSampleSizes.clear();
+}
+
+
+void FedDictionaries::Insert(unsigned fedIdx, const std::string &content) {
+   auto itr = fDictionaries.find(fedIdx);
+   if (itr != fDictionaries.end()) {
+      ZSTD_freeCDict(itr->second.fCDict);
+      ZSTD_freeDDict(itr->second.fDDict);
+      fDictionaries.erase(itr);
+   }
+
+   Dictionary d;
+   d.fContent = content;
+   d.fCDict = ZSTD_createCDict(d.fContent.data(), d.fContent.size(), fCompressionLevel);
+   d.fDDict = ZSTD_createDDict(d.fContent.data(), d.fContent.size());
+   if (!d.fCDict || !d.fDDict) {
+      fprintf(stderr, "cannot create zstd dictionary for FED %u\n", fedIdx);
+      abort();
+   }
+   fDictionaries[fedIdx] = d;
+}
+
+
+void FedDictionaries::Save(const std::string &path) const {
+   std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+   auto fnWrite32 = [&file](std::uint32_t value) { file.write(reinterpret_cast<const char *>(&value), 4); };
+   fnWrite32(fDictionaries.size());
+   for (const auto &d : fDictionaries) {
+      fnWrite32(d.first);
+      fnWrite32(d.second.fContent.size());
+      file.write(d.second.fContent.data(), d.second.fContent.size());
+   }
+   if (!file) {
+      fprintf(stderr, "cannot write dictionaries to %s\n", path.c_str());
+      abort();
+   }
+}
+
+
+void FedDictionaries::Load(const std::string &path) {
+   std::ifstream file(path, std::ifstream::binary);
+   auto fnRead32 = [&file]() {
+      std::uint32_t value = 0;
+      file.read(reinterpret_cast<char *>(&value), 4);
+      return value;
+   };
+   auto nDicts = fnRead32();
+   for (std::uint32_t i = 0; i < nDicts && file; ++i) {
+      auto fedIdx = fnRead32();
+      std::string content(fnRead32(), '\0');
+      file.read(&content[0], content.size());
+      Insert(fedIdx, content);
+   }
+   if (!file) {
+      fprintf(stderr, "cannot read dictionaries from %s\n", path.c_str());
+      abort();
+   }
+}
+
+
+void FedDictionaries::Compress(unsigned fedIdx, const Blob &payload, Blob *zipped) {
+   auto itr = fDictionaries.find(fedIdx);
+   if (payload.empty() || itr == fDictionaries.end()) {
+      *zipped = payload;
+      return;
+   }
+   if (!fCCtx)
+      fCCtx = ZSTD_createCCtx();
+   zipped->resize(ZSTD_compressBound(payload.size()));
+   auto size = ZSTD_compress_usingCDict(fCCtx, zipped->data(), zipped->size(), payload.data(), payload.size(),
+                                        itr->second.fCDict);
+   if (ZSTD_isError(size)) {
+      fprintf(stderr, "zstd compression failed for FED %u: %s\n", fedIdx, ZSTD_getErrorName(size));
+      abort();
+   }
+   zipped->resize(size);
+}
+
+
+void FedDictionaries::Decompress(unsigned fedIdx, const Blob &zipped, Blob *payload) {
+   auto itr = fDictionaries.find(fedIdx);
+   if (zipped.empty() || itr == fDictionaries.end()) {
+      *payload = zipped;
+      return;
+   }
+   if (!fDCtx)
+      fDCtx = ZSTD_createDCtx();
+   // The frame header contains the payload size, ZSTD_compress_usingCDict() always writes it
+   auto size = ZSTD_getFrameContentSize(zipped.data(), zipped.size());
+   if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) {
+      fprintf(stderr, "invalid zstd frame for FED %u\n", fedIdx);
+      abort();
+   }
+   payload->resize(size);
+   auto result = ZSTD_decompress_usingDDict(fDCtx, payload->data(), payload->size(), zipped.data(), zipped.size(),
+                                            itr->second.fDDict);
+   if (ZSTD_isError(result) || result != size) {
+      fprintf(stderr, "zstd decompression failed for FED %u\n", fedIdx);
+      abort();
+   }
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef FEDDICT_H_
+#define FEDDICT_H_
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+/**
+ * Trained zstd dictionaries for the FED payloads of the CMS raw data, one dictionary per FED index.  Payloads of
+ * FED indexes with a dictionary are stored as zstd frames, all other payloads are stored as is.  Empty payloads
+ * stay empty.  The dictionaries are stored next to the ntuple in a ".zdict" file with the layout
+ *
+ *     uint32 number of dictionaries
+ *     per dictionary: uint32 FED index, uint32 size, size bytes dictionary
+ */
+class FedDictionaries {
+public:
+   using Blob = std::vector<unsigned char>;
+
+   FedDictionaries() = default;
+   FedDictionaries(const FedDictionaries &other) = delete;
+   FedDictionaries &operator =(const FedDictionaries &other) = delete;
+   ~FedDictionaries();
+
+   /// Adds an event's payloads to the training sample
+   void AddSample(const std::vector<Blob> &event);
+   /// Trains the dictionaries of the collected samples and releases the samples.  FED indexes with too few or too
+   /// small samples get no dictionary.
+   void Train(std::size_t dictSize, int compressionLevel);
+
+   void Save(const std::string &path) const;
+   void Load(const std::string &path);
+
+   bool HasDictionary(unsigned fedIdx) const { return fDictionaries.count(fedIdx) > 0; }
+   std::size_t GetNDictionaries() const { return fDictionaries.size(); }
+
+   void Compress(unsigned fedIdx, const Blob &payload, Blob *zipped);
+   void Decompress(unsigned fedIdx, const Blob &zipped, Blob *payload);
+
+private:
+   struct Dictionary {
+      std::string fContent;
+      ZSTD_CDict_s *fCDict = nullptr;
+      ZSTD_DDict_s *fDDict = nullptr;
+   };
+
+   void Insert(unsigned fedIdx, const std::string &content);
+
+   std::map<unsigned, std::string> fSamples;
+   std::map<unsigned, std::vector<std::size_t>> fSampleSizes;
+   std::map<unsigned, Dictionary> fDictionaries;
+   int fCompressionLevel = 3;
+   // Reusable compression and decompression contexts
+   ZSTD_CCtx_s *fCCtx = nullptr;
+   ZSTD_DCtx_s *fDCtx = nullptr;
+};
+
+#endif  // FEDDICT_H_
@@ -0,0 +1,101 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include "filter.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "util.h"
+
+ColumnFilter ParseColumnFilter(const std::string &spec) {
+   ColumnFilter filter;
+   if (spec == "none")
+      return filter;
+   for (const auto &token : SplitString(spec, '+')) {
+      if (token == "shuffle") {
+         filter.fShuffle = true;
+      } else if (token == "delta") {
+         filter.fDelta = true;
+      } else if (token.compare(0, 5, "trunc") == 0 && token.size() > 5) {
+         filter.fMantissaBits = String2Uint64(token.substr(5));
+         if (filter.fMantissaBits < 1 || filter.fMantissaBits > 52) {
+            fprintf(stderr, "invalid number of mantissa bits in %s\n", spec.c_str());
+            abort();
+         }
+      } else {
+         fprintf(stderr, "unknown column filter %s\n", token.c_str());
+         abort();
+      }
+   }
+   return filter;
+}
+
+
+std::string ColumnFilter::ToString() const {
+   std::vector<std::string> tokens;
+   if (fShuffle)
+      tokens.emplace_back("shuffle");
+   if (fDelta)
+      tokens.emplace_back("delta");
+   if (fMantissaBits > 0)
+      tokens.emplace_back("trunc" + std::to_string(fMantissaBits));
+   return tokens.empty() ? "none" : JoinStrings(tokens, "+");
+}
+
+
+/// Rounds the IEEE 754 bit pattern to the nearest value with nBits mantissa bits; zero bits, Inf, and NaN leave the
+/// value as is
+template <typename T, typename BitsT, unsigned kMantissaBits, unsigned kExponentBits>
+static T TruncateMantissaImpl(T value, unsigned nBits) {
+   if (nBits == 0 || nBits >= kMantissaBits)
+      return value;
+   BitsT bits;
+   memcpy(&bits, &value, sizeof(T));
+   const BitsT kExponentMask = ((BitsT(1) << kExponentBits) - 1) << kMantissaBits;
+   if ((bits & kExponentMask) == kExponentMask)
+      return value;
+   unsigned nDrop = kMantissaBits - nBits;
+   // A carry from the rounding may overflow into the exponent, which yields the correctly rounded value
+   bits += BitsT(1) << (nDrop - 1);
+   bits &= ~((BitsT(1) << nDrop) - 1);
+   memcpy(&value, &bits, sizeof(T));
+   return value;
+}
+
+
+float TruncateMantissa(float value, unsigned nBits) {
+   return TruncateMantissaImpl<float, std::uint32_t, 23, 8>(value, nBits);
+}
+
+
+double TruncateMantissa(double value, unsigned nBits) {
+   return TruncateMantissaImpl<double, std::uint64_t, 52, 11>(value, nBits);
+}
+
+
+void ByteShuffle(const unsigned char *src, std::size_t nbytes, std::size_t elementSize, unsigned char *dst) {
+   std::size_t nElements = nbytes / elementSize;
+   for (std::size_t i = 0; i < nElements; ++i) {
+      for (std::size_t b = 0; b < elementSize; ++b)
+         dst[b * nElements + i] = src[i * elementSize + b];
+   }
+   // A trailing partial element is copied as is
+   std::size_t nTail = nbytes - nElements * elementSize;
+   memcpy(dst + nElements * elementSize, src + nElements * elementSize, nTail);
+}
+
+
+void ByteUnshuffle(const unsigned char *src, std::size_t nbytes, std::size_t elementSize, unsigned char *dst) {
+   std::size_t nElements = nbytes / elementSize;
+   for (std::size_t i = 0; i < nElements; ++i) {
+      for (std::size_t b = 0; b < elementSize; ++b)
+         dst[i * elementSize + b] = src[b * nElements + i];
+   }
+   std::size_t nTail = nbytes - nElements * elementSize;
+   memcpy(dst + nElements * elementSize, src + nElements * elementSize, nTail);
+}
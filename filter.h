@@ -0,0 +1,82 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+/**
+ * Pre-compression transformations of column values.  A filter specification is a '+' separated list of
+ *
+ *   - shuffle: byte-split the elements of a page, i.e. store all first bytes, then all second bytes, ...
+ *   - delta:   store the difference to the previous value instead of the value (integers only)
+ *   - truncN:  keep only N mantissa bits of floating point values (lossy)
+ *
+ * e.g. "shuffle+trunc12".  Truncation changes the values themselves, so readers need no decoding step; it is the
+ * only filter the generators apply.  Shuffling and delta encoding need a decoding step that neither the analyses nor
+ * RDataFrame or skim have, so the generators refuse them.  bm_codec applies them to the pages and undoes them with
+ * ByteUnshuffle() resp. DeltaDecode() to measure their effect on compression ratio and speed.
+ */
+struct ColumnFilter {
+   bool fShuffle = false;
+   bool fDelta = false;
+   /// Number of mantissa bits kept for float and double values; zero keeps the full precision
+   unsigned fMantissaBits = 0;
+
+   bool IsEmpty() const { return !fShuffle && !fDelta && (fMantissaBits == 0); }
+   /// The inverse of ParseColumnFilter(), "none" for the empty filter
+   std::string ToString() const;
+};
+
+ColumnFilter ParseColumnFilter(const std::string &spec);
+
+/// nBits == 0 returns the value unchanged
+float TruncateMantissa(float value, unsigned nBits);
+double TruncateMantissa(double value, unsigned nBits);
+
+void ByteShuffle(const unsigned char *src, std::size_t nbytes, std::size_t elementSize, unsigned char *dst);
+void ByteUnshuffle(const unsigned char *src, std::size_t nbytes, std::size_t elementSize, unsigned char *dst);
+
+/// Delta encoding of a value sequence, one value at a time
+template <typename T>
+class DeltaCoder {
+   static_assert(std::is_integral<T>::value, "delta encoding requires integer values");
+   using U = typename std::make_unsigned<T>::type;
+   T fLast = 0;
+
+public:
+   /// The next value is encoded resp. decoded as is, e.g. at the start of a cluster
+   void Reset() { fLast = 0; }
+   // Wrap-around arithmetic on the unsigned type keeps the encoding reversible for any input
+   T Encode(T value) {
+      T delta = static_cast<T>(static_cast<U>(value) - static_cast<U>(fLast));
+      fLast = value;
+      return delta;
+   }
+   T Decode(T delta) {
+      fLast = static_cast<T>(static_cast<U>(fLast) + static_cast<U>(delta));
+      return fLast;
+   }
+};
+
+/// In-place delta encoding of a page; the first value is stored as is
+template <typename T>
+void DeltaEncode(T *values, std::size_t n) {
+   DeltaCoder<T> coder;
+   for (std::size_t i = 0; i < n; ++i)
+      values[i] = coder.Encode(values[i]);
+}
+
+template <typename T>
+void DeltaDecode(T *values, std::size_t n) {
+   DeltaCoder<T> coder;
+   for (std::size_t i = 0; i < n; ++i)
+      values[i] = coder.Decode(values[i]);
+}
+
+#endif  // FILTER_H_
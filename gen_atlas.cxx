@@ -20,6 +20,7 @@
 
 #include <unistd.h>
 
+#include "policy.h"
 #include "util.h"
 
 // Import classes from experimental namespace for the time being
@@ -29,7 +30,7 @@ using RNTupleWriter = ROOT::Experimental::RNTupleWriter;
 using RNTupleWriteOptions = ROOT::Experimental::RNTupleWriteOptions;
 
 void Usage(char *progname) {
-   std::cout << "Usage: " << progname << " -i <gg_*.root> -o <ntuple-path> -c <compression>" << std::endl;
+   std::cout << "Usage: " << progname << " -i <gg_*.root> -o <ntuple-path> -c <compression> [-P <policy>]" << std::endl;
 }
 
 
@@ -38,9 +39,10 @@ int main(int argc, char **argv) {
    std::string outputPath = ".";
    int compressionSettings = 0;
    std::string compressionShorthand = "none";
+   std::string policyPath;
 
    int c;
-   while ((c = getopt(argc, argv, "hvi:o:c:")) != -1) {
+   while ((c = getopt(argc, argv, "hvi:o:c:P:")) != -1) {
       switch (c) {
       case 'h':
       case 'v':
@@ -56,12 +58,18 @@ int main(int argc, char **argv) {
          compressionSettings = GetCompressionSettings(optarg);
          compressionShorthand = optarg;
          break;
+      case 'P':
+         policyPath = optarg;
+         break;
       default:
          fprintf(stderr, "Unknown option: -%c\n", c);
          Usage(argv[0]);
          return 1;
       }
    }
+   CompressionPolicy policy(compressionSettings);
+   if (!policyPath.empty())
+      policy = CompressionPolicy::Load(policyPath, compressionSettings);
    std::string flavor = SplitString(GetFileName(StripSuffix(inputFile)), '~')[0];
    std::string outputFile = outputPath + "/" + flavor + "~" + compressionShorthand + ".ntuple";
    std::cout << "Converting " << inputFile << " --> " << outputFile << std::endl;
@@ -86,6 +94,7 @@ int main(int argc, char **argv) {
       auto field = RFieldBase::Create(l->GetName(), l->GetTypeName()).Unwrap();
       std::cout << "Convert leaf " << l->GetName() << " [" << l->GetTypeName() << "]"
                 << " --> " << "field " << field->GetName() << " [" << field->GetType() << "]" << std::endl;
+      policy.Resolve(field->GetName());
 
       if (typeid(*b) == typeid(TBranchSTL) || typeid(*b) == typeid(TBranchElement)) {
          // TODO: generic way of dealing with vector<T>
@@ -126,9 +135,14 @@ int main(int argc, char **argv) {
 
    // The new ntuple takes ownership of the model
    RNTupleWriteOptions options;
-   options.SetCompression(compressionSettings);
+   policy.CheckApplicable();
+   options.SetCompression(policy.GetCompression());
    //options.SetNumElementsPerPage(64000);
    auto ntuple = RNTupleWriter::Recreate(std::move(model), "mini", outputFile, options);
+   if (!policyPath.empty()) {
+      policy.WriteMetadata(outputFile + ".policy");
+      std::cout << "Applied compression policy recorded in " << outputFile << ".policy" << std::endl;
+   }
 
    auto nEntries = tree->GetEntries();
    std::cout << "Processing " << nEntries << " entries" << std::endl;
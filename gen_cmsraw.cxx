@@ -16,6 +16,9 @@
 #include <TSystem.h>
 
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -23,16 +26,63 @@
 
 #include <unistd.h>
 
+#include "feddict.h"
+#include "policy.h"
 #include "util.h"
 
 // Import classes from experimental namespace for the time being
 using RNTupleModel = ROOT::Experimental::RNTupleModel;
+using RNTupleReader = ROOT::Experimental::RNTupleReader;
 using RFieldBase = ROOT::Experimental::Detail::RFieldBase;
 using RNTupleWriter = ROOT::Experimental::RNTupleWriter;
 using RNTupleWriteOptions = ROOT::Experimental::RNTupleWriteOptions;
 
+// Size of the trained zstd dictionary per FED index
+static constexpr std::size_t kDictSize = 64 * 1024;
+
+/**
+ * Reads back the ntuple written with dictionaries, as a reader would: the dictionaries come from the .zdict file
+ * and every payload is restored with the dictionary of its FED index.  Aborts unless all payloads match the input.
+ */
+static void VerifyDictionaries(TTree *tree, const std::string &ntuplePath) {
+   FedDictionaries dictionaries;
+   dictionaries.Load(ntuplePath + ".zdict");
+
+   auto model = RNTupleModel::Create();
+   auto vNtuple = model->MakeField<std::vector<std::vector<unsigned char>>>("v");
+   auto ntuple = RNTupleReader::Open(std::move(model), "Events", ntuplePath);
+   TTreeReader reader(tree);
+   TTreeReaderValue<std::vector<std::vector<unsigned char>>> vTree(reader, "v");
+
+   FedDictionaries::Blob payload;
+   std::uint64_t nBytesZipped = 0;
+   std::uint64_t nBytesPayload = 0;
+   for (auto i : ntuple->GetEntryRange()) {
+      ntuple->LoadEntry(i);
+      if (!reader.Next() || vNtuple->size() != vTree->size()) {
+         fprintf(stderr, "dictionary verification failed: event %llu does not match the input\n",
+                 static_cast<unsigned long long>(i));
+         abort();
+      }
+      for (unsigned fedIdx = 0; fedIdx < vNtuple->size(); ++fedIdx) {
+         dictionaries.Decompress(fedIdx, (*vNtuple)[fedIdx], &payload);
+         if (payload != (*vTree)[fedIdx]) {
+            fprintf(stderr, "dictionary verification failed: FED %u of event %llu differs from the input\n",
+                    fedIdx, static_cast<unsigned long long>(i));
+            abort();
+         }
+         nBytesZipped += (*vNtuple)[fedIdx].size();
+         nBytesPayload += payload.size();
+      }
+   }
+   std::cout << "Verified " << ntuple->GetNEntries() << " events with the dictionaries of " << ntuplePath
+             << ".zdict, " << nBytesPayload << " B payload from " << nBytesZipped << " B" << std::endl;
+}
+
+
 void Usage(char *progname) {
-   std::cout << "Usage: " << progname << " -o <ntuple output dir> -c <compression> -o <tree input>"
+   std::cout << "Usage: " << progname << " -o <ntuple output dir> -c <compression> -i <tree input> [-P <policy>]"
+             << " [-D <#events for zstd dictionary training>]"
              << std::endl;
 }
 
@@ -42,9 +92,11 @@ int main(int argc, char **argv) {
    std::string outputDir;
    int compressionSettings = 0;
    std::string compressionShorthand = "none";
+   std::string policyPath;
+   unsigned nTrainingEvents = 0;
 
    int c;
-   while ((c = getopt(argc, argv, "hvo:c:i:")) != -1) {
+   while ((c = getopt(argc, argv, "hvo:c:i:P:D:")) != -1) {
       switch (c) {
       case 'h':
       case 'v':
@@ -57,9 +109,15 @@ int main(int argc, char **argv) {
          compressionSettings = GetCompressionSettings(optarg);
          compressionShorthand = optarg;
          break;
+      case 'P':
+         policyPath = optarg;
+         break;
       case 'i':
          inputPath = optarg;
          break;
+      case 'D':
+         nTrainingEvents = String2Uint64(optarg);
+         break;
       default:
          fprintf(stderr, "Unknown option: -%c\n", c);
          Usage(argv[0]);
@@ -71,17 +129,47 @@ int main(int argc, char **argv) {
       return 1;
    }
 
+   CompressionPolicy policy(compressionSettings);
+   if (!policyPath.empty())
+      policy = CompressionPolicy::Load(policyPath, compressionSettings);
+   if (nTrainingEvents > 0)
+      compressionShorthand += "+zdict";
    std::string outputFile = outputDir + "/cmsraw~" + compressionShorthand + ".ntuple";
    std::cout << "Converting " << inputPath << " --> " << outputFile << std::endl;
 
    auto file = TFile::Open(inputPath.c_str());
    auto tree = file->Get<TTree>("Events");
+
+   // With -D, every FED payload is compressed with the dictionary of its FED index before it is handed to the
+   // ntuple.  The dictionaries are trained on the first events and stored in <output>.zdict for the readers.
+   FedDictionaries dictionaries;
+   if (nTrainingEvents > 0) {
+      TTreeReader trainingReader(tree);
+      TTreeReaderValue<std::vector<std::vector<unsigned char>>> vTraining(trainingReader, "v");
+      unsigned nSamples = 0;
+      while (nSamples < nTrainingEvents && trainingReader.Next()) {
+         dictionaries.AddSample(*vTraining);
+         nSamples++;
+      }
+      // Unless the zstd level is given by -c, use the zstd default level
+      int level = (compressionSettings / 100 == 5) ? compressionSettings % 100 : 3;
+      dictionaries.Train(kDictSize, level);
+      dictionaries.Save(outputFile + ".zdict");
+      std::cout << "Trained " << dictionaries.GetNDictionaries() << " FED dictionaries on " << nSamples
+                << " events, stored in " << outputFile << ".zdict" << std::endl;
+   }
    auto model = RNTupleModel::Create();
    auto vNtuple = model->MakeField<std::vector<std::vector<unsigned char>>>("v");
+   policy.Resolve("v");
    RNTupleWriteOptions options;
-   options.SetCompression(compressionSettings);
+   policy.CheckApplicable();
+   options.SetCompression(policy.GetCompression());
    options.SetNumElementsPerPage(100000);
    auto ntuple = RNTupleWriter::Recreate(std::move(model), "Events", outputFile, options);
+   if (!policyPath.empty()) {
+      policy.WriteMetadata(outputFile + ".policy");
+      std::cout << "Applied compression policy recorded in " << outputFile << ".policy" << std::endl;
+   }
 
    TTreeReader reader(tree);
    TTreeReaderValue<std::vector<std::vector<unsigned char>>> vTree(reader, "v");
@@ -89,9 +177,21 @@ int main(int argc, char **argv) {
    // Fills the ntuple with entries from the TTree.
    int count = 0;
    while(reader.Next()) {
-      *vNtuple = *vTree;
+      if (nTrainingEvents > 0) {
+         vNtuple->resize(vTree->size());
+         for (unsigned i = 0; i < vTree->size(); ++i)
+            dictionaries.Compress(i, (*vTree)[i], &(*vNtuple)[i]);
+      } else {
+         *vNtuple = *vTree;
+      }
       ntuple->Fill();
       if (++count % 1000 == 0)
          std::cout << "Wrote " << count << " events" << std::endl;
    }
+
+   if (nTrainingEvents > 0) {
+      // Closes the ntuple
+      ntuple.reset();
+      VerifyDictionaries(tree, outputFile);
+   }
 }
@@ -16,6 +16,7 @@
 #include <TSystem.h>
 
 #include <cassert>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -23,17 +24,79 @@
 
 #include <unistd.h>
 
+#include "filter.h"
 #include "h1event.h"
+#include "policy.h"
 #include "util.h"
+#include "zonemap.h"
 
 // Import classes from experimental namespace for the time being
 using RNTupleModel = ROOT::Experimental::RNTupleModel;
 using RFieldBase = ROOT::Experimental::Detail::RFieldBase;
 using RNTupleWriter = ROOT::Experimental::RNTupleWriter;
 using RNTupleWriteOptions = ROOT::Experimental::RNTupleWriteOptions;
+using RCollectionNTuple = ROOT::Experimental::RCollectionNTuple;
+
+/**
+ * Writes H1Event in the flat layout: every member is a top-level field, the electrons, tracks, and jets are
+ * collections with one subfield per member, e.g. "tracks.nhitrp".
+ */
+class H1FlatWriter {
+#define H1_FLAT_DECLARE(N) std::shared_ptr<decltype(H1Event::N)> f_##N;
+#define H1_FLAT_DECLARE_ELECTRON(N) std::shared_ptr<decltype(H1Event::Electron::N)> fElectron_##N;
+#define H1_FLAT_DECLARE_TRACK(N) std::shared_ptr<decltype(H1Event::Track::N)> fTrack_##N;
+#define H1_FLAT_DECLARE_JET(N) std::shared_ptr<decltype(H1Event::Jet::N)> fJet_##N;
+   H1_EVENT_MEMBERS(H1_FLAT_DECLARE)
+   H1_ELECTRON_MEMBERS(H1_FLAT_DECLARE_ELECTRON)
+   H1_TRACK_MEMBERS(H1_FLAT_DECLARE_TRACK)
+   H1_JET_MEMBERS(H1_FLAT_DECLARE_JET)
+   std::shared_ptr<RCollectionNTuple> fElectrons;
+   std::shared_ptr<RCollectionNTuple> fTracks;
+   std::shared_ptr<RCollectionNTuple> fJets;
+
+public:
+   explicit H1FlatWriter(RNTupleModel *model) {
+#define H1_FLAT_MAKE(N) f_##N = model->MakeField<decltype(H1Event::N)>(#N);
+#define H1_FLAT_MAKE_ELECTRON(N) fElectron_##N = electronModel->MakeField<decltype(H1Event::Electron::N)>(#N);
+#define H1_FLAT_MAKE_TRACK(N) fTrack_##N = trackModel->MakeField<decltype(H1Event::Track::N)>(#N);
+#define H1_FLAT_MAKE_JET(N) fJet_##N = jetModel->MakeField<decltype(H1Event::Jet::N)>(#N);
+      H1_EVENT_MEMBERS(H1_FLAT_MAKE)
+      auto electronModel = RNTupleModel::Create();
+      H1_ELECTRON_MEMBERS(H1_FLAT_MAKE_ELECTRON)
+      fElectrons = model->MakeCollection("electrons", std::move(electronModel));
+      auto trackModel = RNTupleModel::Create();
+      H1_TRACK_MEMBERS(H1_FLAT_MAKE_TRACK)
+      fTracks = model->MakeCollection("tracks", std::move(trackModel));
+      auto jetModel = RNTupleModel::Create();
+      H1_JET_MEMBERS(H1_FLAT_MAKE_JET)
+      fJets = model->MakeCollection("jets", std::move(jetModel));
+   }
+
+   /// Sets the field values of the next entry; the caller fills the ntuple
+   void Set(const H1Event &event) {
+#define H1_FLAT_SET(N) *f_##N = event.N;
+#define H1_FLAT_SET_ELECTRON(N) *fElectron_##N = e.N;
+#define H1_FLAT_SET_TRACK(N) *fTrack_##N = t.N;
+#define H1_FLAT_SET_JET(N) *fJet_##N = j.N;
+      H1_EVENT_MEMBERS(H1_FLAT_SET)
+      for (const auto &e : event.electrons) {
+         H1_ELECTRON_MEMBERS(H1_FLAT_SET_ELECTRON)
+         fElectrons->Fill();
+      }
+      for (const auto &t : event.tracks) {
+         H1_TRACK_MEMBERS(H1_FLAT_SET_TRACK)
+         fTracks->Fill();
+      }
+      for (const auto &j : event.jets) {
+         H1_JET_MEMBERS(H1_FLAT_SET_JET)
+         fJets->Fill();
+      }
+   }
+};
 
 void Usage(char *progname) {
-   std::cout << "Usage: " << progname << " -o <ntuple-path> -c <compression> [-b bloat factor] <H1 dst files>"
+   std::cout << "Usage: " << progname << " -o <ntuple-path> -c <compression> [-b bloat factor] [-P <policy>] [-F(lat layout)]"
+             << " <H1 dst files>"
              << std::endl;
 }
 
@@ -43,10 +106,12 @@ int main(int argc, char **argv) {
    std::string outputPath = ".";
    int compressionSettings = 0;
    std::string compressionShorthand = "none";
+   std::string policyPath;
    unsigned int bloatFactor = 1;
+   bool flatLayout = false;
 
    int c;
-   while ((c = getopt(argc, argv, "hvo:c:b:")) != -1) {
+   while ((c = getopt(argc, argv, "hvo:c:b:P:F")) != -1) {
       switch (c) {
       case 'h':
       case 'v':
@@ -59,6 +124,12 @@ int main(int argc, char **argv) {
          compressionSettings = GetCompressionSettings(optarg);
          compressionShorthand = optarg;
          break;
+      case 'P':
+         policyPath = optarg;
+         break;
+      case 'F':
+         flatLayout = true;
+         break;
       case 'b':
          bloatFactor = std::stoi(optarg);
          break;
@@ -71,7 +142,10 @@ int main(int argc, char **argv) {
    for (auto i = optind; i < argc; ++i)
       inputFiles.emplace_back(argv[i]);
 
-   std::string outputFile = outputPath + "/h1dst";
+   CompressionPolicy policy(compressionSettings);
+   if (!policyPath.empty())
+      policy = CompressionPolicy::Load(policyPath, compressionSettings);
+   std::string outputFile = outputPath + "/h1dst" + (flatLayout ? "flat" : "");
    if (bloatFactor > 1) {
       std::cout << "   ... using bloat factor x" << bloatFactor << std::endl;
       outputFile += std::string("X") + ((bloatFactor < 10) ? "0" : "") + std::to_string(bloatFactor);
@@ -84,14 +158,34 @@ int main(int argc, char **argv) {
       tree->Add(p.c_str());
 
    gSystem->Load("./libH1event.so");
-   // Create a ntuple model with a single field
+   // Create a ntuple model with a single field or, for the flat layout, with a field per member
    auto model = RNTupleModel::Create();
-   auto ev = model->MakeField<H1Event>("event");
+   std::shared_ptr<H1Event> ev;
+   std::unique_ptr<H1FlatWriter> flatWriter;
+   if (flatLayout) {
+      flatWriter.reset(new H1FlatWriter(model.get()));
+   } else {
+      ev = model->MakeField<H1Event>("event");
+   }
+   policy.Resolve("event");
+   // The only member-level filter of the event class, see filter.h
+   ColumnFilter covarFilter;
+   policy.Resolve("event.tracks.covar", &covarFilter);
    // h42 refers to the name of the ntuple.
    RNTupleWriteOptions options;
-   options.SetCompression(compressionSettings);
+   policy.CheckApplicable();
+   options.SetCompression(policy.GetCompression());
    //options.SetNumElementsPerPage(30000);
    auto ntuple = RNTupleWriter::Recreate(std::move(model), "h42", outputFile, options);
+   if (!policyPath.empty()) {
+      policy.WriteMetadata(outputFile + ".policy");
+      std::cout << "Applied compression policy recorded in " << outputFile << ".policy" << std::endl;
+   }
+   // Per-zone minimum and maximum of the scalar event members
+   ZoneMap zoneMap;
+#define H1_ZONEMAP_ADD(N) const auto zoneMapColumn_##N = zoneMap.AddColumn(#N);
+   H1_EVENT_MEMBERS(H1_ZONEMAP_ADD)
+   std::uint64_t entryCounter = 0;
    int count = 0;
 
    for (unsigned round = 0; round < bloatFactor; ++round) {
@@ -381,7 +475,7 @@ int main(int argc, char **argv) {
          for(int i = *ntracks; i > 0; --i) {
             std::array<float, 15> ar;
             for(int j = 0; j < 15; ++j) {
-               ar.at(j) = covar[i][j];
+               ar.at(j) = TruncateMantissa(covar[i][j], covarFilter.fMantissaBits);
             }
             covarVec.emplace_back(ar);
          }
@@ -403,8 +497,18 @@ int main(int argc, char **argv) {
             pthrust2NTuple.at(i) = pthrust2[i];
          }
          H1Event eventEntry{/*0-9*/ *nrun, *nevent, *nentry, std::move(trelemNTuple), std::move(subtrNTuple), std::move(rawtrNTuple), std::move(L4subtrNTuple), std::move(L5classNTuple), *E33, *de33, /*10-19*/ *x33, *dx33, *y33, *dy33, *E44, *de44, *x44, *dx44, *y44, *dy44, /*20-29*/ *Ept, *dept, *xpt, *dxpt, *ypt, *dypt, std::move(pelecNTuple), *flagelec, *xeelec, *yeelec, /*30-39*/ *Q2eelec, /* *nelec,*/ std::move(nelecNTuple), sumcNTuple, /*40-49*/ *sumetc, *yjbc, *Q2jbc, std::move(sumctNTuple), *sumetct, *yjbct, *Q2jbct, *yjbct, *Q2jbct, std::move(pvtx_dNTuple), /*50-59*/ std::move(cpvtx_dNTuple), std::move(pvtx_tNTuple), std::move(cpvtx_tNTuple), *ntrkxy_t, *prbxy_t, *ntrkz_t, *prbz_t, *nds, *rankds, *qds, /*60-69*/ std::move(pds_dNTuple), *ptds_d, *etads_d, *dm_d, *ddm_d, std::move(pds_tNTuple), *dm_t, *ddm_t, *ik, *ipi, /*70-79*/ *ipis, std::move(pd0_dNTuple), *ptd0_d, *etad0_d, *md0_d, *dmd0_d, std::move(pd0_tNTuple), *md0_t, *dmd0_t, std::move(pk_rNTuple), /*80-89*/ std::move(ppi_rNTuple), std::move(pd0_rNTuple), *md0_r, std::move(Vtxd0_rNTuple), std::move(cvtxd0_rNTuple), *dxy_r, *dz_r, *psi_r, *rd0_d, *drd0_d, /*90-99*/ *rpd0_d, *drpd0_d, *rd0_t, *drd0_t, *rpd0_t, *drpd0_t, *rd0_dt, *drd0_dt, *prbr_dt, *prbz_dt, /*100-109*/ *rd0_tt, *drd0_tt, *prbr_tt, *prbz_tt, *ijetd0, *ptr3d0_j, *ptr2d0_j, *ptr3d0_3, *ptr2d0_3, *ptr2d0_2, /*110-134*/ *Mimpds_r, *Mimpbk_r, /* *ntracks,*/ std::move(ntrackNTuple), /*135-143*/ *imu, *imufe, /* *njets,*/ std::move(njetNTuple), /*144-151*/ *thrust, std::move(pthrustNTuple), *thrust2, std::move(pthrust2NTuple), *spher, *aplan, *plan, {nnout[0]}};
-         *ev = eventEntry;
+         // The zone map refers to the original values, as seen by the TTree analysis
+#define H1_ZONEMAP_UPDATE(N) zoneMap.UpdateAny(zoneMapColumn_##N, entryCounter, eventEntry.N);
+         H1_EVENT_MEMBERS(H1_ZONEMAP_UPDATE)
+         if (flatLayout)
+            flatWriter->Set(eventEntry);
+         else
+            *ev = eventEntry;
+         entryCounter++;
          ntuple->Fill();
       }  // while (reader.Next())
    }  // for (round)
+
+   zoneMap.Save(outputFile + ".zonemap");
+   std::cout << "Zone map of " << zoneMap.GetNZones() << " zones written to " << outputFile << ".zonemap" << std::endl;
 }
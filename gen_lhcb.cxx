@@ -11,6 +11,7 @@
 #include <TTree.h>
 
 #include <cassert>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -18,7 +19,10 @@
 
 #include <unistd.h>
 
+#include "filter.h"
+#include "policy.h"
 #include "util.h"
+#include "zonemap.h"
 
 // Import classes from experimental namespace for the time being
 using RNTupleModel = ROOT::Experimental::RNTupleModel;
@@ -26,8 +30,46 @@ using RFieldBase = ROOT::Experimental::Detail::RFieldBase;
 using RNTupleWriter = ROOT::Experimental::RNTupleWriter;
 using RNTupleWriteOptions = ROOT::Experimental::RNTupleWriteOptions;
 
+/// A leaf whose values are transformed according to the compression policy before being written
+struct FilteredLeaf {
+   void *fPtr;
+   std::string fType;
+   ColumnFilter fFilter;
+};
+
+
+/// A leaf whose per-zone minimum and maximum is recorded in the zone map
+struct ZoneMapLeaf {
+   void *fPtr;
+   std::string fType;
+   unsigned fColumn;
+};
+
+
+static void UpdateZoneMap(const ZoneMapLeaf &leaf, std::uint64_t entry, ZoneMap *zoneMap) {
+   if (leaf.fType == "Double_t") {
+      zoneMap->Update(leaf.fColumn, entry, *static_cast<double *>(leaf.fPtr));
+   } else if (leaf.fType == "Float_t") {
+      zoneMap->Update(leaf.fColumn, entry, *static_cast<float *>(leaf.fPtr));
+   } else if (leaf.fType == "Int_t") {
+      zoneMap->Update(leaf.fColumn, entry, *static_cast<std::int32_t *>(leaf.fPtr));
+   }
+}
+
+
+static void ApplyFilter(FilteredLeaf *leaf) {
+   if (leaf->fType == "Double_t") {
+      auto value = static_cast<double *>(leaf->fPtr);
+      *value = TruncateMantissa(*value, leaf->fFilter.fMantissaBits);
+   } else if (leaf->fType == "Float_t") {
+      auto value = static_cast<float *>(leaf->fPtr);
+      *value = TruncateMantissa(*value, leaf->fFilter.fMantissaBits);
+   }
+}
+
+
 void Usage(char *progname) {
-   std::cout << "Usage: " << progname << " -i <B2HHH.root> -o <ntuple-path> -c <compression>" << std::endl;
+   std::cout << "Usage: " << progname << " -i <B2HHH.root> -o <ntuple-path> -c <compression> [-P <policy>]" << std::endl;
 }
 
 
@@ -36,9 +78,10 @@ int main(int argc, char **argv) {
    std::string outputPath = ".";
    int compressionSettings = 0;
    std::string compressionShorthand = "none";
+   std::string policyPath;
 
    int c;
-   while ((c = getopt(argc, argv, "hvi:o:c:")) != -1) {
+   while ((c = getopt(argc, argv, "hvi:o:c:P:")) != -1) {
       switch (c) {
       case 'h':
       case 'v':
@@ -54,12 +97,18 @@ int main(int argc, char **argv) {
          compressionSettings = GetCompressionSettings(optarg);
          compressionShorthand = optarg;
          break;
+      case 'P':
+         policyPath = optarg;
+         break;
       default:
          fprintf(stderr, "Unknown option: -%c\n", c);
          Usage(argv[0]);
          return 1;
       }
    }
+   CompressionPolicy policy(compressionSettings);
+   if (!policyPath.empty())
+      policy = CompressionPolicy::Load(policyPath, compressionSettings);
    std::string outputFile = outputPath + "/B2HHH~" + compressionShorthand + ".ntuple";
    std::cout << "Converting " << inputFile << " --> " << outputFile << std::endl;
 
@@ -72,6 +121,9 @@ int main(int argc, char **argv) {
    // We create RNTuple fields based on the types found in the TTree
    // This simple approach only works for trees with simple branches and only one leaf per branch
    auto tree = f->Get<TTree>("DecayTree");
+   std::vector<FilteredLeaf> filteredLeafs;
+   ZoneMap zoneMap;
+   std::vector<ZoneMapLeaf> zoneMapLeafs;
    for (auto b : TRangeDynCast<TBranch>(*tree->GetListOfBranches())) {
       // The dynamic cast to TBranch should never fail for GetListOfBranches()
       assert(b);
@@ -81,8 +133,16 @@ int main(int argc, char **argv) {
 
       // Create an ntuple field with the same name and type than the tree branch
       auto field = RFieldBase::Create(l->GetName(), l->GetTypeName()).Unwrap();
+      ColumnFilter filter;
+      policy.Resolve(field->GetName(), &filter);
       std::cout << "Convert leaf " << l->GetName() << " [" << l->GetTypeName() << "]"
-                << " --> " << "field " << field->GetName() << " [" << field->GetType() << "]" << std::endl;
+                << " --> " << "field " << field->GetName() << " [" << field->GetType() << "]"
+                << " filter " << filter.ToString() << std::endl;
+      const std::string typeName = l->GetTypeName();
+      if (filter.fMantissaBits > 0 && typeName == "Int_t") {
+         std::cerr << "filter " << filter.ToString() << " not applicable to " << l->GetName() << std::endl;
+         abort();
+      }
 
       // Hand over ownership of the field to the ntuple model.  This will also create a memory location attached
       // to the model's default entry, that will be used to place the data supposed to be written
@@ -92,20 +152,36 @@ int main(int argc, char **argv) {
       // fill the ntuple with the data read from the TTree
       void *fieldDataPtr = model->GetDefaultEntry()->GetValue(l->GetName()).GetRawPtr();
       tree->SetBranchAddress(b->GetName(), fieldDataPtr);
+      if (filter.fMantissaBits > 0)
+         filteredLeafs.push_back(FilteredLeaf{fieldDataPtr, typeName, filter});
+      zoneMapLeafs.push_back(ZoneMapLeaf{fieldDataPtr, typeName, zoneMap.AddColumn(l->GetName())});
    }
 
    // The new ntuple takes ownership of the model
    RNTupleWriteOptions options;
-   options.SetCompression(compressionSettings);
+   policy.CheckApplicable();
+   options.SetCompression(policy.GetCompression());
    //options.SetNumElementsPerPage(64000);
    auto ntuple = RNTupleWriter::Recreate(std::move(model), "DecayTree", outputFile, options);
+   if (!policyPath.empty()) {
+      policy.WriteMetadata(outputFile + ".policy");
+      std::cout << "Applied compression policy recorded in " << outputFile << ".policy" << std::endl;
+   }
 
    auto nEntries = tree->GetEntries();
    for (decltype(nEntries) i = 0; i < nEntries; ++i) {
       tree->GetEntry(i);
+      // The zone map refers to the original values, as seen by the TTree analysis
+      for (const auto &l : zoneMapLeafs)
+         UpdateZoneMap(l, i, &zoneMap);
+      for (auto &l : filteredLeafs)
+         ApplyFilter(&l);
       ntuple->Fill();
 
       if (i && i % 100000 == 0)
          std::cout << "Wrote " << i << " entries" << std::endl;
    }
+
+   zoneMap.Save(outputFile + ".zonemap");
+   std::cout << "Zone map of " << zoneMap.GetNZones() << " zones written to " << outputFile << ".zonemap" << std::endl;
 }
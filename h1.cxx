@@ -23,20 +23,68 @@
 #include <TSystem.h>
 #include <TTreePerfStats.h>
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <future>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <string>
 #include <vector>
 #include <utility>
 
+#include "basket_counter.h"
+#include "blockcache.h"
+#include "cachedwebfile.h"
+#include "numa.h"
+#include "profile.h"
+#include "skimlist.h"
+#include "slotmonitor.h"
+#include "treecache.h"
 #include "util.h"
+#include "workstealing.h"
+#include "zonemap.h"
 
 bool g_perf_stats = false;
 bool g_show = false;
+std::string g_result_path;
+bool g_flat_layout = false;
+bool g_late_materialization = false;
+std::string g_zone_map_path;
+bool g_skim_list = false;
+std::string g_access_profile_path;
+std::string g_prefetch_profile_path;
+std::string g_block_cache_dir;
+std::uint64_t g_block_cache_limit = BlockCache::kDefaultSizeLimit;
+TreeCacheConfig g_tree_cache;
+TreeUnzipConfig g_tree_unzip;
+bool g_slot_balance = false;
+unsigned g_n_threads = 0;
+bool g_numa_placement = false;
+
+/// Stolen clusters are split down to ranges of this many entries
+constexpr std::uint64_t kMinRangeSize = 1000;
+
+/// The thresholds of the D* cuts, shared by fnSelect, the zone map, and the skim list key
+static constexpr double kMd0Window = 0.04;
+static constexpr double kPtdsCut = 2.5;
+static constexpr double kEtadsCut = 1.5;
+/// Part of the key of the cached skim lists; to be increased with every change of fnSelect other than of the
+/// thresholds, which enter the key by themselves
+static constexpr unsigned kSkimCutVersion = 1;
+
+/// The definition of the D* preselection, the key of the cached skim lists
+static std::string GetSkimCut() {
+   char cut[256];
+   snprintf(cut, sizeof(cut), "v%u: abs(md0_d - 1.8646) < %.17g && ptds_d > %.17g && abs(etads_d) < %.17g",
+            kSkimCutVersion, kMd0Window, kPtdsCut, kEtadsCut);
+   return cut;
+}
 
 static ROOT::Experimental::RNTupleReadOptions GetRNTupleOptions() {
    using RNTupleReadOptions = ROOT::Experimental::RNTupleReadOptions;
@@ -47,6 +95,76 @@ static ROOT::Experimental::RNTupleReadOptions GetRNTupleOptions() {
    return options;
 }
 
+/// Field names in the nested layout (single H1Event field) or in the flat layout written by gen_h1 -F
+static std::string GetEventField(const std::string &member) {
+   return g_flat_layout ? member : "event." + member;
+}
+
+static std::string GetTrackField(const std::string &member) {
+   return g_flat_layout ? "tracks." + member : "event.tracks.H1Event::Track." + member;
+}
+
+/// The zone map given by -z restricted to the ranges of the D* cuts, nullptr without -z
+static std::unique_ptr<ZoneMap> LoadZoneMap() {
+   if (g_zone_map_path.empty())
+      return nullptr;
+   std::unique_ptr<ZoneMap> zoneMap(new ZoneMap(ZoneMap::Load(g_zone_map_path)));
+   zoneMap->AddRange("md0_d", 1.8646 - kMd0Window, 1.8646 + kMd0Window);
+   zoneMap->AddRange("ptds_d", kPtdsCut, std::numeric_limits<double>::infinity());
+   zoneMap->AddRange("etads_d", -kEtadsCut, kEtadsCut);
+   std::cout << "Zone-Map: " << zoneMap->GetNSelected() << " of " << zoneMap->GetNZones() << " zones selected"
+             << std::endl;
+   return zoneMap;
+}
+
+/// The column access profiler given by -a, nullptr otherwise
+static std::unique_ptr<ColumnProfiler> CreateProfiler() {
+   if (g_access_profile_path.empty())
+      return nullptr;
+   return std::unique_ptr<ColumnProfiler>(new ColumnProfiler());
+}
+
+
+static void SaveProfile(const ColumnProfiler *profiler) {
+   if (!profiler)
+      return;
+   profiler->Print();
+   profiler->Save(g_access_profile_path);
+   std::cout << "Column access profile written to " << g_access_profile_path << std::endl;
+}
+
+
+/**
+ * With -S, opens the cached skim list of the D* preselection in skimList or, if there is none yet, creates an empty
+ * skim list in skimRecord to be filled during the event loop.
+ */
+static void OpenSkimList(const std::string &path, std::unique_ptr<SkimList> *skimList,
+                         std::unique_ptr<SkimList> *skimRecord)
+{
+   if (!g_skim_list)
+      return;
+   if (!SkimList::IsCacheable(path)) {
+      std::cout << "Skim-List: disabled, " << path << " is not a local file" << std::endl;
+      return;
+   }
+   *skimList = SkimList::Open(path, GetSkimCut());
+   if (*skimList) {
+      std::cout << "Skim-List: " << (*skimList)->GetNEntries() << " entries from " << (*skimList)->GetPath()
+                << std::endl;
+   } else {
+      skimRecord->reset(new SkimList(path, GetSkimCut()));
+   }
+}
+
+
+static void SaveSkimList(const SkimList *skimRecord) {
+   if (!skimRecord)
+      return;
+   skimRecord->Save();
+   std::cout << "Skim-List: " << skimRecord->GetNEntries() << " entries recorded in " << skimRecord->GetPath()
+             << std::endl;
+}
+
 const Double_t dxbin = (0.17-0.13)/40;   // Bin-width
 const Double_t sigma = 0.0012;
 
@@ -124,126 +242,361 @@ static void Show(TH1D *hdmd, TH2D *h2) {
    }
 }
 
+static void WriteResult(TH1D *hdmd, TH2D *h2) {
+   std::unique_ptr<TFile> f(TFile::Open(g_result_path.c_str(), "RECREATE"));
+   if (!f || f->IsZombie()) {
+      fprintf(stderr, "cannot write result file %s\n", g_result_path.c_str());
+      abort();
+   }
+   f->WriteTObject(hdmd, "hdmd");
+   f->WriteTObject(h2, "h2");
+   f->Close();
+   std::cout << "Wrote histograms to " << g_result_path << std::endl;
+}
+
+/**
+ * The branches read by the TTree direct analysis and the buffers they are read into, shared by TreeDirect and the
+ * workers of TreeDirectMT.  Select() and Fill() read the branches through fnGetEntry(branch, entryId), so that the
+ * single-threaded analysis can route the reads through the column profiler and the basket counter.
+ */
+class H1TreeEvent {
+   float fMd0D;
+   float fPtdsD;
+   float fEtadsD;
+   float fDmD;
+   float fRpd0T;
+   float fPtd0D;
+   Int_t fIk;
+   Int_t fIpi;
+   Int_t fIpis;
+   Int_t fNTracks;
+   Int_t fNJets;
+   Int_t fNHitrp[200];
+   float fRend[200];
+   float fRstart[200];
+   float fNlhk[200];
+   float fNlhpi[200];
+   TBranch *fBrMd0D = nullptr;
+   TBranch *fBrPtdsD = nullptr;
+   TBranch *fBrEtadsD = nullptr;
+   TBranch *fBrDmD = nullptr;
+   TBranch *fBrRpd0T = nullptr;
+   TBranch *fBrPtd0D = nullptr;
+   TBranch *fBrIk = nullptr;
+   TBranch *fBrIpi = nullptr;
+   TBranch *fBrIpis = nullptr;
+   TBranch *fBrNTracks = nullptr;
+   TBranch *fBrNJets = nullptr;
+   TBranch *fBrNHitrp = nullptr;
+   TBranch *fBrRend = nullptr;
+   TBranch *fBrRstart = nullptr;
+   TBranch *fBrNlhk = nullptr;
+   TBranch *fBrNlhpi = nullptr;
+
+public:
+   explicit H1TreeEvent(TTree *tree) {
+      tree->SetBranchAddress("md0_d", &fMd0D, &fBrMd0D);
+      tree->SetBranchAddress("ptds_d", &fPtdsD, &fBrPtdsD);
+      tree->SetBranchAddress("etads_d", &fEtadsD, &fBrEtadsD);
+      tree->SetBranchAddress("dm_d", &fDmD, &fBrDmD);
+      tree->SetBranchAddress("rpd0_t", &fRpd0T, &fBrRpd0T);
+      tree->SetBranchAddress("ptd0_d", &fPtd0D, &fBrPtd0D);
+      tree->SetBranchAddress("ik", &fIk, &fBrIk);
+      tree->SetBranchAddress("ipi", &fIpi, &fBrIpi);
+      tree->SetBranchAddress("ipis", &fIpis, &fBrIpis);
+      tree->SetBranchAddress("ntracks", &fNTracks, &fBrNTracks);
+      tree->SetBranchAddress("njets", &fNJets, &fBrNJets);
+      tree->SetBranchAddress("nhitrp", fNHitrp, &fBrNHitrp);
+      tree->SetBranchAddress("rend", fRend, &fBrRend);
+      tree->SetBranchAddress("rstart", fRstart, &fBrRstart);
+      tree->SetBranchAddress("nlhk", fNlhk, &fBrNlhk);
+      tree->SetBranchAddress("nlhpi", fNlhpi, &fBrNlhpi);
+   }
+   H1TreeEvent(const H1TreeEvent &) = delete;
+   H1TreeEvent &operator=(const H1TreeEvent &) = delete;
+
+   /// The branches of the D* cuts
+   std::vector<TBranch *> GetCutBranches() const { return {fBrMd0D, fBrPtdsD, fBrEtadsD}; }
+   /// The track and jet branches, read only for entries that pass the D* cuts
+   std::vector<TBranch *> GetLateBranches() const {
+      return {fBrDmD, fBrRpd0T, fBrPtd0D, fBrIk, fBrIpi, fBrIpis, fBrNTracks, fBrNJets, fBrNHitrp, fBrRend, fBrRstart,
+              fBrNlhk, fBrNlhpi};
+   }
+
+   /// The cuts on the D* candidate, evaluated before any track information is read; see kSkimCutVersion
+   template <typename FnGetEntry>
+   bool Select(Long64_t entryId, FnGetEntry &&fnGetEntry) {
+      fnGetEntry(fBrMd0D, entryId);
+      if (TMath::Abs(fMd0D - 1.8646) >= kMd0Window) return false;
+      fnGetEntry(fBrPtdsD, entryId);
+      if (fPtdsD <= kPtdsCut) return false;
+      fnGetEntry(fBrEtadsD, entryId);
+      if (TMath::Abs(fEtadsD) >= kEtadsCut) return false;
+      return true;
+   }
+
+   /// The track and jet cuts of a selected entry; fills the histograms if the entry passes
+   template <typename FnGetEntry>
+   void Fill(Long64_t entryId, FnGetEntry &&fnGetEntry, TH1D *hdmd, TH2D *h2) {
+      fnGetEntry(fBrNTracks, entryId);
+      fnGetEntry(fBrIk, entryId);  fIk--; //original ik used f77 convention starting at 1
+      fnGetEntry(fBrIpi, entryId); fIpi--;
+      fnGetEntry(fBrNHitrp, entryId);
+      if (fNHitrp[fIk] * fNHitrp[fIpi] <= 1) return;
+
+      fnGetEntry(fBrRend, entryId);
+      fnGetEntry(fBrRstart, entryId);
+      if (fRend[fIk] - fRstart[fIk] <= 22) return;
+      if (fRend[fIpi] - fRstart[fIpi] <= 22) return;
+
+      fnGetEntry(fBrNlhk, entryId);
+      if (fNlhk[fIk] <= 0.1) return;
+      fnGetEntry(fBrNlhpi, entryId);
+      if (fNlhpi[fIpi] <= 0.1) return;
+      fnGetEntry(fBrIpis, entryId); fIpis--;
+      if (fNlhpi[fIpis] <= 0.1) return;
+
+      fnGetEntry(fBrNJets, entryId);
+      if (fNJets < 1) return;
+
+      fnGetEntry(fBrDmD, entryId);
+      fnGetEntry(fBrRpd0T, entryId);
+      fnGetEntry(fBrPtd0D, entryId);
+      hdmd->Fill(fDmD);
+      h2->Fill(fDmD, fRpd0T / 0.029979 * 1.8646 / fPtd0D);
+   }
+};
+
+
 static void TreeDirect(const std::string &path) {
    auto ts_init = std::chrono::steady_clock::now();
+   g_tree_unzip.Enable();
 
-   auto file = TFile::Open(path.c_str());
+   std::unique_ptr<BlockCache> blockCache;
+   if (!g_block_cache_dir.empty())
+      blockCache.reset(new BlockCache(g_block_cache_dir, g_block_cache_limit));
+   auto file = CachedWebFile::Open(path, blockCache.get());
    auto tree = file->Get<TTree>("h42");
 
    TTreePerfStats *ps = nullptr;
    if (g_perf_stats)
       ps = new TTreePerfStats("ioperf", tree);
-
-   float md0_d;
-   float ptds_d;
-   float etads_d;
-   float dm_d;
-   float rpd0_t;
-   float ptd0_d;
-   Int_t ik;
-   Int_t ipi;
-   Int_t ipis;
-   Int_t ntracks;
-   Int_t njets;
-   Int_t nhitrp[200];
-   float rend[200];
-   float rstart[200];
-   float nlhk[200];
-   float nlhpi[200];
-
-   TBranch *br_md0_d = nullptr;
-   TBranch *br_ptds_d = nullptr;
-   TBranch *br_etads_d = nullptr;
-   TBranch *br_dm_d = nullptr;
-   TBranch *br_rpd0_t = nullptr;
-   TBranch *br_ptd0_d = nullptr;
-   TBranch *br_ik = nullptr;
-   TBranch *br_ipi = nullptr;
-   TBranch *br_ipis = nullptr;
-   TBranch *br_ntracks = nullptr;
-   TBranch *br_njets = nullptr;
-   TBranch *br_nhitrp = nullptr;
-   TBranch *br_rend = nullptr;
-   TBranch *br_rstart = nullptr;
-   TBranch *br_nlhk = nullptr;
-   TBranch *br_nlhpi = nullptr;
-
-   tree->SetBranchAddress("md0_d", &md0_d, &br_md0_d);
-   tree->SetBranchAddress("ptds_d", &ptds_d, &br_ptds_d);
-   tree->SetBranchAddress("etads_d", &etads_d, &br_etads_d);
-   tree->SetBranchAddress("dm_d", &dm_d, &br_dm_d);
-   tree->SetBranchAddress("rpd0_t", &rpd0_t, &br_rpd0_t);
-   tree->SetBranchAddress("ptd0_d", &ptd0_d, &br_ptd0_d);
-   tree->SetBranchAddress("ik", &ik, &br_ik);
-   tree->SetBranchAddress("ipi", &ipi, &br_ipi);
-   tree->SetBranchAddress("ipis", &ipis, &br_ipis);
-   tree->SetBranchAddress("ntracks", &ntracks, &br_ntracks);
-   tree->SetBranchAddress("njets", &njets, &br_njets);
-   tree->SetBranchAddress("nhitrp", nhitrp, &br_nhitrp);
-   tree->SetBranchAddress("rend", rend, &br_rend);
-   tree->SetBranchAddress("rstart", rstart, &br_rstart);
-   tree->SetBranchAddress("nlhk", nlhk, &br_nlhk);
-   tree->SetBranchAddress("nlhpi", nlhpi, &br_nlhpi);
+   // Read the first cluster of the profiled branches before the branch addresses are set up
+   if (!g_prefetch_profile_path.empty())
+      ColumnProfiler::Prefetch(tree, ColumnProfiler::LoadColumns(g_prefetch_profile_path));
+
+   H1TreeEvent event(tree);
+   const auto cutBranches = event.GetCutBranches();
+   const auto lateBranches = event.GetLateBranches();
+   if (g_late_materialization) {
+      // The track and jet branches bypass the tree cache, so that their baskets without selected entries are not read
+      g_tree_cache.ApplyExclusive(tree, cutBranches);
+   } else {
+      auto branches = cutBranches;
+      branches.insert(branches.end(), lateBranches.begin(), lateBranches.end());
+      g_tree_cache.Apply(tree, branches);
+   }
+   g_tree_unzip.Apply(tree);
 
    auto hdmd = new TH1D("hdmd", "dm_d", 40, 0.13, 0.17);
    auto h2   = new TH2D("h2", "ptD0 vs dm_d", 30, 0.135, 0.165, 30, -3, 6);
+   auto zoneMap = LoadZoneMap();
+   std::unique_ptr<SkimList> skimList;
+   std::unique_ptr<SkimList> skimRecord;
+   OpenSkimList(path, &skimList, &skimRecord);
+   auto profiler = CreateProfiler();
+
+   // Reads a branch entry, through the column access profiler with -a
+   auto fnGetEntry = [&profiler](TBranch *branch, Long64_t entry) {
+      if (profiler)
+         profiler->GetEntry(branch, entry);
+      else
+         branch->GetEntry(entry);
+   };
+
+   // The track and jet baskets touched by the selected entries, counted in the -L mode
+   BasketCounter basketCounter(g_late_materialization, lateBranches);
+   auto fnGetLateEntry = [&](TBranch *branch, Long64_t entry) {
+      basketCounter.Count(branch, entry);
+      fnGetEntry(branch, entry);
+   };
 
    auto nEntries = tree->GetEntries();
    std::chrono::steady_clock::time_point ts_first;
-   for (decltype(nEntries) entryId = 0; entryId < nEntries; ++entryId) {
-      if (entryId % 1000 == 0)
-         std::cout << "Processed " << entryId << " entries" << std::endl;
-      if (entryId == 1) {
-         ts_first = std::chrono::steady_clock::now();
+   if (skimList) {
+      // Only the preselected entries, the D* candidate branches are not read
+      ts_first = std::chrono::steady_clock::now();
+      skimList->ForEach([&](std::uint64_t entryId) {
+         tree->LoadTree(entryId);
+         event.Fill(entryId, fnGetEntry, hdmd, h2);
+      });
+   } else if (!g_late_materialization) {
+      for (decltype(nEntries) entryId = 0; entryId < nEntries; ++entryId) {
+         if (entryId % 1000 == 0)
+            std::cout << "Processed " << entryId << " entries" << std::endl;
+         if (entryId == 1) {
+            ts_first = std::chrono::steady_clock::now();
+         }
+
+         if (zoneMap && !zoneMap->IsSelected(entryId)) continue;
+
+         tree->LoadTree(entryId);
+         if (!event.Select(entryId, fnGetEntry)) continue;
+         if (skimRecord) skimRecord->Add(entryId);
+         event.Fill(entryId, fnGetEntry, hdmd, h2);
+      }
+   } else {
+      // Two passes per cluster: the D* cuts on all entries, then the track and jet cuts of the surviving entries
+      std::vector<Long64_t> survivors;
+      auto clusterItr = tree->GetClusterIterator(0);
+      Long64_t clusterStart;
+      while ((clusterStart = clusterItr.Next()) < nEntries) {
+         auto clusterEnd = clusterItr.GetNextEntry();
+         survivors.clear();
+         for (auto entryId = clusterStart; entryId < clusterEnd; ++entryId) {
+            if (entryId % 1000 == 0)
+               std::cout << "Processed " << entryId << " entries" << std::endl;
+            if (entryId == 1)
+               ts_first = std::chrono::steady_clock::now();
+            if (zoneMap && !zoneMap->IsSelected(entryId))
+               continue;
+
+            tree->LoadTree(entryId);
+            if (event.Select(entryId, fnGetEntry))
+               survivors.push_back(entryId);
+         }
+         for (auto entryId : survivors) {
+            if (skimRecord)
+               skimRecord->Add(entryId);
+            event.Fill(entryId, fnGetLateEntry, hdmd, h2);
+         }
       }
-
-      tree->LoadTree(entryId);
-
-      br_md0_d->GetEntry(entryId);
-      if (TMath::Abs(md0_d - 1.8646) >= 0.04) continue;
-      br_ptds_d->GetEntry(entryId);
-      if (ptds_d <= 2.5) continue;
-      br_etads_d->GetEntry(entryId);
-      if (TMath::Abs(etads_d) >= 1.5) continue;
-
-      br_ntracks->GetEntry(entryId);
-      br_ik->GetEntry(entryId);  ik--; //original ik used f77 convention starting at 1
-      br_ipi->GetEntry(entryId); ipi--;
-      br_nhitrp->GetEntry(entryId);
-      if (nhitrp[ik] * nhitrp[ipi] <= 1) continue;
-
-      br_rend->GetEntry(entryId);
-      br_rstart->GetEntry(entryId);
-      if (rend[ik] - rstart[ik] <= 22) continue;
-      if (rend[ipi] - rstart[ipi] <= 22) continue;
-
-      br_nlhk->GetEntry(entryId);
-      if (nlhk[ik] <= 0.1) continue;
-      br_nlhpi->GetEntry(entryId);
-      if (nlhpi[ipi] <= 0.1) continue;
-      br_ipis->GetEntry(entryId); ipis--;
-      if (nlhpi[ipis] <= 0.1) continue;
-
-      br_njets->GetEntry(entryId);
-      if (njets < 1) continue;
-
-      br_dm_d->GetEntry(entryId);
-      br_rpd0_t->GetEntry(entryId);
-      br_ptd0_d->GetEntry(entryId);
-      hdmd->Fill(dm_d);
-      h2->Fill(dm_d, rpd0_t / 0.029979 * 1.8646 / ptd0_d);
    }
+   SaveSkimList(skimRecord.get());
+   SaveProfile(profiler.get());
 
    auto ts_end = std::chrono::steady_clock::now();
    auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
    auto runtime_analyze = std::chrono::duration_cast<std::chrono::microseconds>(ts_end - ts_first).count();
 
-   if (g_perf_stats)
+   if (g_perf_stats) {
       ps->Print();
+      TreeCacheConfig::PrintStats(tree);
+   }
 
    std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
+   if (!skimList)
+      basketCounter.Print();
+   if (blockCache)
+      blockCache->PrintStats();
 
+   if (!g_result_path.empty())
+      WriteResult(hdmd, h2);
+   if (g_show)
+      Show(hdmd, h2);
+   delete hdmd;
+   delete h2;
+}
+
+
+/**
+ * The per-thread state of the TTree direct analysis with -t: file, tree, tree cache, and histograms.  The track and
+ * jet branches hold a variable number of elements per entry, so the cost of an entry depends on the D* cuts; the
+ * work-stealing scheduler evens out clusters with many passing entries.
+ */
+class H1TreeWorker {
+   std::unique_ptr<TFile> fFile;
+   TTree *fTree;
+   H1TreeEvent fEvent;
+   std::unique_ptr<TH1D> fHdmd;
+   std::unique_ptr<TH2D> fH2;
+
+public:
+   H1TreeWorker(const std::string &path, unsigned workerId)
+      : fFile(TFile::Open(path.c_str())), fTree(fFile->Get<TTree>("h42")), fEvent(fTree)
+   {
+      auto branches = fEvent.GetCutBranches();
+      auto lateBranches = fEvent.GetLateBranches();
+      branches.insert(branches.end(), lateBranches.begin(), lateBranches.end());
+      g_tree_cache.Apply(fTree, branches);
+
+      auto suffix = "_" + std::to_string(workerId);
+      fHdmd.reset(new TH1D(("hdmd" + suffix).c_str(), "dm_d", 40, 0.13, 0.17));
+      fHdmd->SetDirectory(nullptr);
+      fH2.reset(new TH2D(("h2" + suffix).c_str(), "ptD0 vs dm_d", 30, 0.135, 0.165, 30, -3, 6));
+      fH2->SetDirectory(nullptr);
+   }
+
+   const TH1D *GetHdmd() const { return fHdmd.get(); }
+   const TH2D *GetH2() const { return fH2.get(); }
+
+   /// Reads the baskets of the first cluster of a stolen range in one go
+   void Prefetch(const WorkStealingScheduler::Range &range) {
+      fTree->LoadTree(range.fFirst);
+      auto cache = fTree->GetReadCache(fTree->GetCurrentFile());
+      if (cache)
+         cache->FillBuffer();
+   }
+
+   void Process(const WorkStealingScheduler::Range &range) {
+      auto fnGetEntry = [](TBranch *branch, Long64_t entry) { branch->GetEntry(entry); };
+      for (auto entryId = range.fFirst; entryId < range.fLast; ++entryId) {
+         fTree->LoadTree(entryId);
+         if (fEvent.Select(entryId, fnGetEntry))
+            fEvent.Fill(entryId, fnGetEntry, fHdmd.get(), fH2.get());
+      }
+   }
+};
+
+
+/**
+ * The clusters of the tree are scheduled on g_n_threads workers by the work-stealing scheduler, as in cms -t.  The
+ * workers open their files on their own threads, i.e. after they have been pinned with NUMA placement (-N).
+ */
+static void TreeDirectMT(const std::string &path) {
+   using Range = WorkStealingScheduler::Range;
+
+   auto ts_init = std::chrono::steady_clock::now();
+   ROOT::EnableThreadSafety();
+   NumaPlacement placement(g_numa_placement);
+
+   std::vector<Range> clusters;
+   std::unique_ptr<TFile> file(TFile::Open(path.c_str()));
+   auto tree = file->Get<TTree>("h42");
+   auto nEntries = tree->GetEntries();
+   auto clusterItr = tree->GetClusterIterator(0);
+   Long64_t clusterStart;
+   while ((clusterStart = clusterItr.Next()) < nEntries)
+      clusters.emplace_back(Range{static_cast<std::uint64_t>(clusterStart),
+                                  static_cast<std::uint64_t>(clusterItr.GetNextEntry())});
+
+   std::vector<std::unique_ptr<H1TreeWorker>> workers(g_n_threads);
+   WorkStealingScheduler scheduler(g_n_threads, kMinRangeSize, &placement);
+   scheduler.Run(clusters,
+      [&workers, &path](unsigned workerId) { workers[workerId].reset(new H1TreeWorker(path, workerId)); },
+      [&workers](unsigned workerId, const Range &range) { workers[workerId]->Process(range); },
+      [&workers](unsigned workerId, const Range &range) { workers[workerId]->Prefetch(range); });
+
+   auto hdmd = new TH1D("hdmd", "dm_d", 40, 0.13, 0.17);
+   auto h2   = new TH2D("h2", "ptD0 vs dm_d", 30, 0.135, 0.165, 30, -3, 6);
+   for (const auto &w : workers) {
+      hdmd->Add(w->GetHdmd());
+      h2->Add(w->GetH2());
+   }
+
+   auto ts_first = scheduler.GetTsReady();
+   auto ts_end = std::chrono::steady_clock::now();
+   auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
+   auto runtime_analyze = std::chrono::duration_cast<std::chrono::microseconds>(ts_end - ts_first).count();
+
+   std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
+   std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
+   placement.Print();
+   scheduler.PrintStats();
+
+   if (!g_result_path.empty())
+      WriteResult(hdmd, h2);
    if (g_show)
       Show(hdmd, h2);
    delete hdmd;
@@ -263,68 +616,80 @@ static void NTupleDirect(const std::string &path) {
    auto ntuple = RNTupleReader::Open(std::move(model), "h42", path, options);
    if (g_perf_stats)
       ntuple->EnableMetrics();
+   auto profiler = CreateProfiler();
 
    auto hdmd = new TH1D("hdmd", "dm_d", 40, 0.13, 0.17);
    auto h2   = new TH2D("h2", "ptD0 vs dm_d", 30, 0.135, 0.165, 30, -3, 6);
+   auto zoneMap = LoadZoneMap();
+   std::unique_ptr<SkimList> skimList;
+   std::unique_ptr<SkimList> skimRecord;
+   OpenSkimList(path, &skimList, &skimRecord);
+
+   auto dm_dView = ColumnProfiler::GetView<float>(profiler.get(), ntuple.get(), GetEventField("dm_d"));
+   auto rpd0_tView = ColumnProfiler::GetView<float>(profiler.get(), ntuple.get(), GetEventField("rpd0_t"));
+   auto ptd0_dView = ColumnProfiler::GetView<float>(profiler.get(), ntuple.get(), GetEventField("ptd0_d"));
+
+   auto ptds_dView = ColumnProfiler::GetView<float>(profiler.get(), ntuple.get(), GetEventField("ptds_d"));
+   auto etads_dView = ColumnProfiler::GetView<float>(profiler.get(), ntuple.get(), GetEventField("etads_d"));
+   auto ikView = ColumnProfiler::GetView<std::int32_t>(profiler.get(), ntuple.get(), GetEventField("ik"));
+   auto ipiView = ColumnProfiler::GetView<std::int32_t>(profiler.get(), ntuple.get(), GetEventField("ipi"));
+   auto ipisView = ColumnProfiler::GetView<std::int32_t>(profiler.get(), ntuple.get(), GetEventField("ipis"));
+   auto md0_dView = ColumnProfiler::GetView<float>(profiler.get(), ntuple.get(), GetEventField("md0_d"));
+
+   auto trackView = ntuple->GetViewCollection(GetEventField("tracks"));
+   auto nhitrpView = ColumnProfiler::GetView<std::int32_t>(profiler.get(), ntuple.get(), GetTrackField("nhitrp"));
+   auto rstartView = ColumnProfiler::GetView<float>(profiler.get(), ntuple.get(), GetTrackField("rstart"));
+   auto rendView = ColumnProfiler::GetView<float>(profiler.get(), ntuple.get(), GetTrackField("rend"));
+   auto nlhkView = ColumnProfiler::GetView<float>(profiler.get(), ntuple.get(), GetTrackField("nlhk"));
+   auto nlhpiView = ColumnProfiler::GetView<float>(profiler.get(), ntuple.get(), GetTrackField("nlhpi"));
+   auto njetsView = ntuple->GetViewCollection(GetEventField("jets"));
+
+   // See kSkimCutVersion
+   auto fnSelect = [&](std::uint64_t i) {
+      if (TMath::Abs(md0_dView(i) - 1.8646) >= kMd0Window) return false;
+      if (ptds_dView(i) <= kPtdsCut) return false;
+      if (TMath::Abs(etads_dView(i)) >= kEtadsCut) return false;
+      return true;
+   };
+
+   // The track and jet cuts of a preselected entry whose tracks start at the item index firstTrack.  The collection
+   // range is resolved once per entry by the caller, the track subfields are then indexed directly.
+   auto fnFill = [&](std::uint64_t i, std::uint64_t firstTrack) {
+      auto trackK = firstTrack + ikView(i) - 1;
+      auto trackPi = firstTrack + ipiView(i) - 1;
+      auto trackPis = firstTrack + ipisView(i) - 1;
+      if (nhitrpView(trackK) * nhitrpView(trackPi) <= 1) return;
+      if (rendView(trackK) - rstartView(trackK) <= 22) return;
+      if (rendView(trackPi) - rstartView(trackPi) <= 22) return;
+      if (nlhkView(trackK) <= 0.1) return;
+      if (nlhpiView(trackPi) <= 0.1) return;
+      if (nlhpiView(trackPis) <= 0.1) return;
+      if (njetsView(i) < 1) return;
 
-   auto dm_dView = ntuple->GetView<float>("event.dm_d");
-   auto rpd0_tView = ntuple->GetView<float>("event.rpd0_t");
-   auto ptd0_dView = ntuple->GetView<float>("event.ptd0_d");
-
-   auto ptds_dView = ntuple->GetView<float>("event.ptds_d");
-   auto etads_dView = ntuple->GetView<float>("event.etads_d");
-   auto ikView = ntuple->GetView<std::int32_t>("event.ik");
-   auto ipiView = ntuple->GetView<std::int32_t>("event.ipi");
-   auto ipisView = ntuple->GetView<std::int32_t>("event.ipis");
-   auto md0_dView = ntuple->GetView<float>("event.md0_d");
-
-   auto trackView = ntuple->GetViewCollection("event.tracks");
-   auto nhitrpView = ntuple->GetView<std::int32_t>("event.tracks.H1Event::Track.nhitrp");
-   auto rstartView = ntuple->GetView<float>("event.tracks.H1Event::Track.rstart");
-   auto rendView = ntuple->GetView<float>("event.tracks.H1Event::Track.rend");
-   auto nlhkView = ntuple->GetView<float>("event.tracks.H1Event::Track.nlhk");
-   auto nlhpiView = ntuple->GetView<float>("event.tracks.H1Event::Track.nlhpi");
-   auto njetsView = ntuple->GetViewCollection("event.jets");
+      hdmd->Fill(dm_dView(i));
+      h2->Fill(dm_dView(i),rpd0_tView(i)/0.029979*1.8646/ptd0_dView(i));
+   };
 
    std::chrono::steady_clock::time_point ts_first;
-   for (auto i : ntuple->GetEntryRange()) {
-      if (i % 1000 == 0)
-         std::cout << "Processed " << i << " entries" << std::endl;
-      if (i == 1) {
-         ts_first = std::chrono::steady_clock::now();
-      }
-
-      auto ik = ikView(i) - 1;
-      auto ipi = ipiView(i) - 1;
-      auto ipis = ipisView(i) - 1;
-
-      if (TMath::Abs(md0_dView(i) - 1.8646) >= 0.04) continue;
-      if (ptds_dView(i) <= 2.5) continue;
-      if (TMath::Abs(etads_dView(i)) >= 1.5) continue;
-
-      if (nhitrpView(*trackView.GetCollectionRange(i).begin()+ik) *
-          nhitrpView(*trackView.GetCollectionRange(i).begin()+ipi) <= 1)
-      {
-         continue;
-      }
-      if (rendView(*trackView.GetCollectionRange(i).begin()+ik) -
-          rstartView(*trackView.GetCollectionRange(i).begin()+ik) <= 22)
-      {
-         continue;
+   if (skimList) {
+      ts_first = std::chrono::steady_clock::now();
+      skimList->ForEach([&](std::uint64_t i) { fnFill(i, *trackView.GetCollectionRange(i).begin()); });
+   } else {
+      for (auto i : ntuple->GetEntryRange()) {
+         if (i % 1000 == 0)
+            std::cout << "Processed " << i << " entries" << std::endl;
+         if (i == 1) {
+            ts_first = std::chrono::steady_clock::now();
+         }
+         if (zoneMap && !zoneMap->IsSelected(i)) continue;
+
+         if (!fnSelect(i)) continue;
+         if (skimRecord) skimRecord->Add(i);
+         fnFill(i, *trackView.GetCollectionRange(i).begin());
       }
-      if (rendView(*trackView.GetCollectionRange(i).begin()+ipi) -
-          rstartView(*trackView.GetCollectionRange(i).begin()+ipi) <= 22)
-      {
-         continue;
-      }
-      if (nlhkView(*trackView.GetCollectionRange(i).begin()+ik) <= 0.1) continue;
-      if (nlhpiView(*trackView.GetCollectionRange(i).begin()+ipi) <= 0.1) continue;
-      if (nlhpiView(*trackView.GetCollectionRange(i).begin()+ipis) <= 0.1) continue;
-      if (njetsView(i) < 1) continue;
-
-      hdmd->Fill(dm_dView(i));
-      h2->Fill(dm_dView(i),rpd0_tView(i)/0.029979*1.8646/ptd0_dView(i));
    }
+   SaveSkimList(skimRecord.get());
+   SaveProfile(profiler.get());
 
    auto ts_end = std::chrono::steady_clock::now();
    auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
@@ -335,6 +700,8 @@ static void NTupleDirect(const std::string &path) {
    std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
 
+   if (!g_result_path.empty())
+      WriteResult(hdmd, h2);
    if (g_show)
       Show(hdmd, h2);
 
@@ -342,17 +709,19 @@ static void NTupleDirect(const std::string &path) {
    delete h2;
 }
 
+/// The number of RDataFrame processing slots
+static unsigned GetNSlots() {
+   return ROOT::IsImplicitMTEnabled() ? ROOT::GetImplicitMTPoolSize() : 1;
+}
+
+
 static void TreeRdf(const std::string &path) {
    auto ts_init = std::chrono::steady_clock::now();
-   std::chrono::steady_clock::time_point ts_first;
-   bool ts_first_set = false;
 
    ROOT::RDataFrame df("h42", path);
-   auto df_timing = df.Define("TIMING", [&ts_first, &ts_first_set]() {
-      if (!ts_first_set)
-         ts_first = std::chrono::steady_clock::now();
-      ts_first_set = true;
-      return ts_first_set;}).Filter([](bool b){ return b; }, {"TIMING"});
+   SlotMonitor monitor(GetNSlots(), g_slot_balance);
+   auto df_timing = df.Filter([&monitor](unsigned int slot, ULong64_t entry) { return monitor.Tick(slot, entry); },
+                              {"rdfslot_", "rdfentry_"});
 
    auto df_md0_d = df_timing.Filter([](float md0_d) {return TMath::Abs(md0_d - 1.8646) < 0.04;}, {"md0_d"});
    auto df_ptds_d = df_md0_d.Filter([](float ptds_d) {return ptds_d > 2.5;}, {"ptds_d"});
@@ -384,11 +753,17 @@ static void TreeRdf(const std::string &path) {
    *hdmd;
    *h2;
    auto ts_end = std::chrono::steady_clock::now();
+   auto ts_first = monitor.GetTsFirst();
    auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
    auto runtime_analyze = std::chrono::duration_cast<std::chrono::microseconds>(ts_end - ts_first).count();
 
    std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
+   monitor.Print(ts_end);
+   // The implicit MT threads are not pinned; reported like the -t and -U runners
+   NumaPlacement(false).Print();
+   if (!g_result_path.empty())
+      WriteResult(hdmd.GetPtr(), h2.GetPtr());
    if (g_show)
       Show(hdmd.GetPtr(), h2.GetPtr());
 }
@@ -396,17 +771,14 @@ static void TreeRdf(const std::string &path) {
 
 static void NTupleRdf(const std::string &path) {
    auto ts_init = std::chrono::steady_clock::now();
-   std::chrono::steady_clock::time_point ts_first;
-   bool ts_first_set = false;
 
    auto df = ROOT::Experimental::MakeNTupleDataFrame("h42", path);
-   auto df_timing = df.Define("TIMING", [&ts_first, &ts_first_set]() {
-      if (!ts_first_set)
-         ts_first = std::chrono::steady_clock::now();
-      ts_first_set = true;
-      return ts_first_set;}).Filter([](bool b){ return b; }, {"TIMING"});
+   SlotMonitor monitor(GetNSlots(), g_slot_balance);
+   auto df_timing = df.Filter([&monitor](unsigned int slot, ULong64_t entry) { return monitor.Tick(slot, entry); },
+                              {"rdfslot_", "rdfentry_"});
 
-   auto df_md0_d = df_timing.Filter([](float md0_d) {return TMath::Abs(md0_d - 1.8646) < 0.04;}, {"event.md0_d"});
+   auto df_md0_d = df_timing.Filter([](float md0_d) {return TMath::Abs(md0_d - 1.8646) < 0.04;},
+                                   {GetEventField("md0_d")});
    auto df_ptds_d = df_md0_d.Filter([](float ptds_d) {return ptds_d > 2.5;}, {"ptds_d"});
    auto df_etads_d = df_ptds_d.Filter([](float etads_d) {return etads_d < 1.5;}, {"etads_d"});
 
@@ -436,11 +808,17 @@ static void NTupleRdf(const std::string &path) {
    *hdmd;
    *h2;
    auto ts_end = std::chrono::steady_clock::now();
+   auto ts_first = monitor.GetTsFirst();
    auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
    auto runtime_analyze = std::chrono::duration_cast<std::chrono::microseconds>(ts_end - ts_first).count();
 
    std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
+   monitor.Print(ts_end);
+   // The implicit MT threads are not pinned; reported like the -t and -U runners
+   NumaPlacement(false).Print();
+   if (!g_result_path.empty())
+      WriteResult(hdmd.GetPtr(), h2.GetPtr());
    if (g_show)
       Show(hdmd.GetPtr(), h2.GetPtr());
 }
@@ -450,7 +828,16 @@ static void NTupleRdf(const std::string &path) {
 
 static void Usage(const char *progname) {
   printf("%s [-i input.root/ntuple] [-r(df)] [-m(t)] [-p(erformance stats)]\n"
-         "   [-s(show)] [-m(t)]\n", progname);
+         "   [-s(show)] [-m(t)] [-o result.root] [-F(lat ntuple layout, gen_h1 -F)]\n"
+         "   [-L(ate materialization, TTree direct only)] [-z zone map (direct only)]\n"
+         "   [-S(kim list cache, direct only)] [-a column access profile (direct only)]\n"
+         "   [-w prefetch list from a column access profile (TTree direct only)]\n"
+         "   [-C block cache directory[,size limit in MB] (TTree direct over HTTP only)]\n"
+         "   [-T tree cache size in MB[,fill] (TTree direct only)]\n"
+         "   [-b(alance report per processing slot, rdf only)]\n"
+         "   [-t threads of the work-stealing cluster scheduler (TTree direct only)]\n"
+         "   [-N(UMA placement of the -t workers)]\n"
+         "   [-Z unzip threads[,unzip budget in MB] (TTree direct only)]\n", progname);
 }
 
 int main(int argc, char **argv) {
@@ -459,7 +846,7 @@ int main(int argc, char **argv) {
    bool use_rdf = false;
    std::string path;
    int c;
-   while ((c = getopt(argc, argv, "hvpsri:m")) != -1) {
+   while ((c = getopt(argc, argv, "hvpsri:mo:FLz:Sa:w:C:T:Z:bt:N")) != -1) {
       switch (c) {
       case 'h':
       case 'v':
@@ -474,12 +861,55 @@ int main(int argc, char **argv) {
       case 'i':
          path = optarg;
          break;
+      case 'o':
+         g_result_path = optarg;
+         break;
       case 'r':
          use_rdf = true;
          break;
+      case 'b':
+         g_slot_balance = true;
+         break;
+      case 't':
+         g_n_threads = String2Uint64(optarg);
+         break;
+      case 'N':
+         g_numa_placement = true;
+         break;
       case 'm':
          ROOT::EnableImplicitMT();
          break;
+      case 'F':
+         g_flat_layout = true;
+         break;
+      case 'L':
+         g_late_materialization = true;
+         break;
+      case 'z':
+         g_zone_map_path = optarg;
+         break;
+      case 'S':
+         g_skim_list = true;
+         break;
+      case 'a':
+         g_access_profile_path = optarg;
+         break;
+      case 'w':
+         g_prefetch_profile_path = optarg;
+         break;
+      case 'C': {
+         auto cacheSpec = SplitString(optarg, ',');
+         g_block_cache_dir = cacheSpec[0];
+         if (cacheSpec.size() > 1)
+            g_block_cache_limit = String2Uint64(cacheSpec[1]) * 1024 * 1024;
+         break;
+      }
+      case 'T':
+         g_tree_cache = TreeCacheConfig::Parse(optarg);
+         break;
+      case 'Z':
+         g_tree_unzip = TreeUnzipConfig::Parse(optarg);
+         break;
       default:
          fprintf(stderr, "Unknown option: -%c\n", c);
          Usage(argv[0]);
@@ -490,12 +920,42 @@ int main(int argc, char **argv) {
       Usage(argv[0]);
       return 1;
    }
+   if (g_tree_cache.IsSet() && !g_prefetch_profile_path.empty()) {
+      fprintf(stderr, "-T and -w are mutually exclusive\n");
+      return 1;
+   }
+   if (g_tree_cache.IsDisabled() && g_tree_unzip.IsSet()) {
+      fprintf(stderr, "-Z requires a tree cache, it cannot be combined with -T 0\n");
+      return 1;
+   }
+   if (g_numa_placement && (g_n_threads == 0)) {
+      fprintf(stderr, "-N requires -t\n");
+      return 1;
+   }
+   // The workers open their files directly and run the plain analysis
+   if ((g_n_threads > 0) && (g_late_materialization || !g_zone_map_path.empty() || g_skim_list ||
+                             !g_access_profile_path.empty() || !g_prefetch_profile_path.empty() ||
+                             !g_block_cache_dir.empty() || g_perf_stats || g_tree_unzip.IsSet()))
+   {
+      fprintf(stderr, "-t cannot be combined with -L, -z, -S, -a, -w, -C, -p, or -Z\n");
+      return 1;
+   }
 
    auto suffix = GetSuffix(path);
+   if (!g_prefetch_profile_path.empty() && (use_rdf || (GetFileFormat(suffix) != FileFormats::kRoot))) {
+      fprintf(stderr, "-w requires the TTree direct path\n");
+      return 1;
+   }
+   if ((g_n_threads > 0) && (use_rdf || (GetFileFormat(suffix) != FileFormats::kRoot))) {
+      fprintf(stderr, "-t requires the TTree direct path\n");
+      return 1;
+   }
    switch (GetFileFormat(suffix)) {
    case FileFormats::kRoot:
       if (use_rdf)
          TreeRdf(path);
+      else if (g_n_threads > 0)
+         TreeDirectMT(path);
       else
          TreeDirect(path);
       break;
@@ -184,4 +184,34 @@ struct H1Event {
    std::array<float, 1> nnout; // 151
 };
 
+// X-macro lists of the H1Event members, used to write and read the flat (columnar) layout of the event with one
+// top-level field per member and one collection per nested struct, see gen_h1 -F
+
+// Members except for the electron, track, and jet collections
+#define H1_EVENT_MEMBERS(X) \
+   X(nrun) X(nevent) X(nentry) X(trelem) X(subtr) X(rawtr) X(L4subtr) X(L5class) X(E33) X(de33) X(x33) X(dx33) \
+   X(y33) X(dy33) X(E44) X(de44) X(x44) X(dx44) X(y44) X(dy44) X(Ept) X(dept) X(xpt) X(dxpt) X(ypt) X(dypt) \
+   X(pelec) X(flagelec) X(xeelec) X(yeelec) X(Q2eelec) X(sumc) X(sumetc) X(yjbc) X(Q2jbc) X(sumct) X(sumetct) \
+   X(yjbct) X(Q2jbct) X(Ebeamel) X(Ebeampr) X(pvtx_d) X(cpvtx_d) X(pvtx_t) X(cpvtx_t) X(ntrkxy_t) X(prbxy_t) \
+   X(ntrkz_t) X(prbz_t) X(nds) X(rankds) X(qds) X(pds_d) X(ptds_d) X(etads_d) X(dm_d) X(ddm_d) X(pds_t) X(dm_t) \
+   X(ddm_t) X(ik) X(ipi) X(ipis) X(pd0_d) X(ptd0_d) X(etad0_d) X(md0_d) X(dmd0_d) X(pd0_t) X(md0_t) X(dmd0_t) \
+   X(pk_r) X(ppi_r) X(pd0_r) X(md0_r) X(Vtxd0_r) X(cvtxd0_r) X(dxy_r) X(dz_r) X(psi_r) X(rd0_d) X(drd0_d) X(rpd0_d) \
+   X(drpd0_d) X(rd0_t) X(drd0_t) X(rpd0_t) X(drpd0_t) X(rd0_dt) X(drd0_dt) X(prbr_dt) X(prbz_dt) X(rd0_tt) \
+   X(drd0_tt) X(prbr_tt) X(prbz_tt) X(ijetd0) X(ptr3d0_j) X(ptr2d0_j) X(ptr3d0_3) X(ptr2d0_3) X(ptr2d0_2) \
+   X(Mimpds_r) X(Mimpbk_r) X(imu) X(imufe) X(thrust) X(pthrust) X(thrust2) X(pthrust2) X(spher) X(aplan) X(plan) \
+   X(nnout)
+
+// Members of H1Event::Electron
+#define H1_ELECTRON_MEMBERS(X) \
+   X(Eelec) X(thetelec) X(phielec) X(xelec) X(Q2elec) X(xsigma) X(Q2sigma)
+
+// Members of H1Event::Track
+#define H1_TRACK_MEMBERS(X) \
+   X(pt) X(kappa) X(phi) X(theta) X(dca) X(z0) X(covar) X(nhitrp) X(prbrp) X(nhitz) X(prbz) X(rstart) X(rend) \
+   X(lhk) X(lhpi) X(nlhk) X(nlhpi) X(dca_d) X(ddca_d) X(dca_t) X(ddca_t) X(muqual)
+
+// Members of H1Event::Jet
+#define H1_JET_MEMBERS(X) \
+   X(E_j) X(pt_j) X(theta_j) X(eta_j) X(phi_j) X(m_j)
+
 #endif
@@ -0,0 +1,181 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include <TClass.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TKey.h>
+#include <TList.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <unistd.h>
+
+/**
+ * FNV-1a over the bit patterns of all bin contents and errors, including under- and overflow bins.  Two histograms
+ * with the same checksum are bit-identical.
+ */
+static std::uint64_t Checksum(const TH1 *h) {
+   std::uint64_t hash = 14695981039346656037ULL;
+   auto fnAdd = [&hash](double value) {
+      unsigned char bytes[sizeof(double)];
+      memcpy(bytes, &value, sizeof(double));
+      for (auto b : bytes) {
+         hash ^= b;
+         hash *= 1099511628211ULL;
+      }
+   };
+   for (Int_t i = 0; i < h->GetNcells(); ++i) {
+      fnAdd(h->GetBinContent(i));
+      fnAdd(h->GetBinError(i));
+   }
+   fnAdd(h->GetEntries());
+   return hash;
+}
+
+
+static bool IsClose(double a, double b, double tolerance) {
+   if (a == b)
+      return true;
+   if (tolerance == 0.0)
+      return false;
+   return std::abs(a - b) <= tolerance * std::max(std::abs(a), std::abs(b));
+}
+
+
+/**
+ * Returns true if both histograms have the same binning and all bin contents and errors agree within the relative
+ * tolerance.  A tolerance of zero requires bit-identical results.
+ */
+static bool Compare(const TH1 *a, const TH1 *b, double tolerance) {
+   if (a->GetNcells() != b->GetNcells()) {
+      std::cout << "   different number of bins: " << a->GetNcells() << " vs. " << b->GetNcells() << std::endl;
+      return false;
+   }
+   if (a->GetDimension() != b->GetDimension()) {
+      std::cout << "   different dimensions" << std::endl;
+      return false;
+   }
+
+   bool result = true;
+   if (!IsClose(a->GetEntries(), b->GetEntries(), tolerance)) {
+      std::cout << "   different number of entries: " << a->GetEntries() << " vs. " << b->GetEntries() << std::endl;
+      result = false;
+   }
+   for (Int_t i = 0; i < a->GetNcells(); ++i) {
+      if (!IsClose(a->GetBinContent(i), b->GetBinContent(i), tolerance) ||
+          !IsClose(a->GetBinError(i), b->GetBinError(i), tolerance))
+      {
+         printf("   bin %d: %.17g +- %.17g vs. %.17g +- %.17g\n", i,
+                a->GetBinContent(i), a->GetBinError(i), b->GetBinContent(i), b->GetBinError(i));
+         result = false;
+      }
+   }
+   return result;
+}
+
+
+static void Usage(const char *progname) {
+   printf("%s [-t relative tolerance] result.root [other-result.root]\n"
+          "   prints histogram checksums of a single result file or compares two result files\n", progname);
+}
+
+
+int main(int argc, char **argv) {
+   double tolerance = 0.0;
+   int c;
+   while ((c = getopt(argc, argv, "hvt:")) != -1) {
+      switch (c) {
+      case 'h':
+      case 'v':
+         Usage(argv[0]);
+         return 0;
+      case 't':
+         tolerance = std::stod(optarg);
+         break;
+      default:
+         fprintf(stderr, "Unknown option: -%c\n", c);
+         Usage(argv[0]);
+         return 1;
+      }
+   }
+   if ((argc - optind) < 1 || (argc - optind) > 2) {
+      Usage(argv[0]);
+      return 1;
+   }
+
+   // The histograms read below are owned here, not by the files
+   TH1::AddDirectory(false);
+   std::unique_ptr<TFile> fileA(TFile::Open(argv[optind]));
+   if (!fileA || fileA->IsZombie()) {
+      std::cerr << "cannot open " << argv[optind] << std::endl;
+      return 1;
+   }
+   std::unique_ptr<TFile> fileB;
+   if ((argc - optind) == 2) {
+      fileB.reset(TFile::Open(argv[optind + 1]));
+      if (!fileB || fileB->IsZombie()) {
+         std::cerr << "cannot open " << argv[optind + 1] << std::endl;
+         return 1;
+      }
+   }
+
+   unsigned nCompared = 0;
+   unsigned nFailed = 0;
+   for (auto key : TRangeDynCast<TKey>(*fileA->GetListOfKeys())) {
+      auto cl = TClass::GetClass(key->GetClassName());
+      if (!cl || !cl->InheritsFrom(TH1::Class()))
+         continue;
+
+      std::unique_ptr<TH1> hA(key->ReadObject<TH1>());
+      printf("%-20s %016llx", key->GetName(), static_cast<unsigned long long>(Checksum(hA.get())));
+      if (!fileB) {
+         printf("\n");
+         continue;
+      }
+
+      std::unique_ptr<TH1> hB(fileB->Get<TH1>(key->GetName()));
+      if (!hB) {
+         printf("  MISSING\n");
+         nFailed++;
+         continue;
+      }
+      printf("  %016llx", static_cast<unsigned long long>(Checksum(hB.get())));
+      nCompared++;
+      if (Checksum(hA.get()) == Checksum(hB.get())) {
+         printf("  IDENTICAL\n");
+         continue;
+      }
+      printf("\n");
+      if (Compare(hA.get(), hB.get(), tolerance)) {
+         printf("%-20s EQUAL (tolerance %g)\n", key->GetName(), tolerance);
+      } else {
+         printf("%-20s DIFFERENT\n", key->GetName());
+         nFailed++;
+      }
+   }
+
+   if (fileB) {
+      // Histograms that only exist in the second file
+      for (auto key : TRangeDynCast<TKey>(*fileB->GetListOfKeys())) {
+         auto cl = TClass::GetClass(key->GetClassName());
+         if (!cl || !cl->InheritsFrom(TH1::Class()) || fileA->GetKey(key->GetName()))
+            continue;
+         std::unique_ptr<TH1> hB(key->ReadObject<TH1>());
+         printf("%-20s %16s  %016llx  MISSING\n", key->GetName(), "",
+                static_cast<unsigned long long>(Checksum(hB.get())));
+         nFailed++;
+      }
+      std::cout << "Compared " << nCompared << " histograms, " << nFailed << " mismatches" << std::endl;
+      return (nFailed > 0) ? 1 : 0;
+   }
+   return 0;
+}
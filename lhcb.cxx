@@ -10,9 +10,12 @@
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <future>
+#include <limits>
 #include <memory>
 #include <string>
 #include <vector>
@@ -35,10 +38,58 @@
 #include <TTreeReader.h>
 #include <TTreePerfStats.h>
 
+#include "basket_counter.h"
+#include "blockcache.h"
+#include "cachedwebfile.h"
+#include "chunkview.h"
+#include "decodepool.h"
+#include "numa.h"
+#include "profile.h"
+#include "shmcache.h"
+#include "skimlist.h"
+#include "slotmonitor.h"
+#include "treecache.h"
 #include "util.h"
+#include "zonemap.h"
 
 bool g_perf_stats = false;
 bool g_show = false;
+std::string g_result_path;
+bool g_late_materialization = false;
+std::string g_zone_map_path;
+bool g_skim_list = false;
+std::string g_access_profile_path;
+std::string g_prefetch_profile_path;
+std::string g_block_cache_dir;
+std::uint64_t g_block_cache_limit = BlockCache::kDefaultSizeLimit;
+std::uint64_t g_shm_cache_size = 0;
+std::uint64_t g_chunk_file_size = 0;
+unsigned g_decode_threads = 0;
+bool g_numa_placement = false;
+TreeCacheConfig g_tree_cache;
+TreeUnzipConfig g_tree_unzip;
+bool g_rdf_fused = false;
+bool g_slot_balance = false;
+
+/// The node-wide segment of the shared chunk cache, in /dev/shm
+static const char *kShmCacheName = "/iotools-lhcb-chunks";
+
+/// The thresholds of the particle identification cuts, shared by fnSelect, the zone map, and the skim list key
+static constexpr double kProbKCut = 0.5;
+static constexpr double kProbPiCut = 0.5;
+/// Part of the key of the cached skim lists; to be increased with every change of fnSelect other than of the
+/// thresholds, which enter the key by themselves
+static constexpr unsigned kSkimCutVersion = 1;
+
+/// The definition of the preselection, the key of the cached skim lists
+static std::string GetSkimCut() {
+   char cut[512];
+   snprintf(cut, sizeof(cut), "v%u: !H1_isMuon && !H2_isMuon && !H3_isMuon && "
+            "H1_ProbK >= %.17g && H2_ProbK >= %.17g && H3_ProbK >= %.17g && "
+            "H1_ProbPi <= %.17g && H2_ProbPi <= %.17g && H3_ProbPi <= %.17g", kSkimCutVersion,
+            kProbKCut, kProbKCut, kProbKCut, kProbPiCut, kProbPiCut, kProbPiCut);
+   return cut;
+}
 
 //static ROOT::Experimental::RNTupleReadOptions GetRNTupleOptions() {
 //   using RNTupleReadOptions = ROOT::Experimental::RNTupleReadOptions;
@@ -71,6 +122,83 @@ static void Show(TH1D *h) {
 }
 
 
+static void WriteResult(TH1D *h) {
+   std::unique_ptr<TFile> f(TFile::Open(g_result_path.c_str(), "RECREATE"));
+   if (!f || f->IsZombie()) {
+      fprintf(stderr, "cannot write result file %s\n", g_result_path.c_str());
+      abort();
+   }
+   f->WriteTObject(h, "B_mass");
+   f->Close();
+   std::cout << "Wrote histograms to " << g_result_path << std::endl;
+}
+
+
+/// The zone map given by -z restricted to the ranges of the particle identification cuts, nullptr without -z
+static std::unique_ptr<ZoneMap> LoadZoneMap() {
+   if (g_zone_map_path.empty())
+      return nullptr;
+   std::unique_ptr<ZoneMap> zoneMap(new ZoneMap(ZoneMap::Load(g_zone_map_path)));
+   for (std::string h : {"H1", "H2", "H3"}) {
+      zoneMap->AddRange(h + "_isMuon", 0, 0);
+      zoneMap->AddRange(h + "_ProbK", kProbKCut, std::numeric_limits<double>::infinity());
+      zoneMap->AddRange(h + "_ProbPi", -std::numeric_limits<double>::infinity(), kProbPiCut);
+   }
+   std::cout << "Zone-Map: " << zoneMap->GetNSelected() << " of " << zoneMap->GetNZones() << " zones selected"
+             << std::endl;
+   return zoneMap;
+}
+
+
+/// The column access profiler given by -a, nullptr otherwise
+static std::unique_ptr<ColumnProfiler> CreateProfiler() {
+   if (g_access_profile_path.empty())
+      return nullptr;
+   return std::unique_ptr<ColumnProfiler>(new ColumnProfiler());
+}
+
+
+static void SaveProfile(const ColumnProfiler *profiler) {
+   if (!profiler)
+      return;
+   profiler->Print();
+   profiler->Save(g_access_profile_path);
+   std::cout << "Column access profile written to " << g_access_profile_path << std::endl;
+}
+
+
+/**
+ * With -S, opens the cached skim list of the preselection in skimList or, if there is none yet, creates an empty
+ * skim list in skimRecord to be filled during the event loop.
+ */
+static void OpenSkimList(const std::string &path, std::unique_ptr<SkimList> *skimList,
+                         std::unique_ptr<SkimList> *skimRecord)
+{
+   if (!g_skim_list)
+      return;
+   if (!SkimList::IsCacheable(path)) {
+      std::cout << "Skim-List: disabled, " << path << " is not a local file" << std::endl;
+      return;
+   }
+   *skimList = SkimList::Open(path, GetSkimCut());
+   if (*skimList) {
+      std::cout << "Skim-List: " << (*skimList)->GetNEntries() << " entries from " << (*skimList)->GetPath()
+                << std::endl;
+   } else {
+      skimRecord->reset(new SkimList(path, GetSkimCut()));
+   }
+}
+
+
+static void SaveSkimList(const SkimList *skimRecord) {
+   if (!skimRecord)
+      return;
+   skimRecord->Save();
+   std::cout << "Skim-List: " << skimRecord->GetNEntries() << " entries recorded in " << skimRecord->GetPath()
+             << std::endl;
+}
+
+
 static double GetP2(double px, double py, double pz)
 {
    return px*px + py*py + pz*pz;
@@ -84,16 +212,63 @@ static double GetKE(double px, double py, double pz)
 
 
 
-static void Dataframe(ROOT::RDataFrame &frame)
+/// The chunk sources of the ntuple direct path: the chunk cache (-M, -D) or the decode pool (-U)
+struct ChunkSources {
+   std::unique_ptr<ShmChunkCache> fCache;
+   std::uint64_t fFileKey = 0;
+   /// One reader per pool thread, as page sources cannot be shared between threads.  The readers of the threads that
+   /// decode chunks of the same cluster each load the pages of their chunks.  The pool is declared last so that it
+   /// stops before the readers close.
+   std::vector<std::unique_ptr<ROOT::Experimental::RNTupleReader>> fPoolReaders;
+   std::shared_ptr<const ChunkLayout> fPoolLayout;
+   std::unique_ptr<DecodePool> fPool;
+};
+
+
+/// The first entry of every cluster of the ntuple
+static std::vector<std::uint64_t> GetClusterStarts(ROOT::Experimental::RNTupleReader *ntuple)
 {
-   auto ts_init = std::chrono::steady_clock::now();
-   std::chrono::steady_clock::time_point ts_first;
+   const auto &descriptor = ntuple->GetDescriptor();
+   std::vector<std::uint64_t> clusterStarts;
+   for (std::uint64_t i = 0; i < descriptor.GetNClusters(); ++i)
+      clusterStarts.push_back(descriptor.GetClusterDescriptor(i).GetFirstEntryIndex());
+   std::sort(clusterStarts.begin(), clusterStarts.end());
+   return clusterStarts;
+}
 
-   auto fn_muon_cut_and_stopwatch = [&](unsigned int slot, ULong64_t entry, int is_muon) {
-      if (entry == 0) {
-         std::cout << "starting timer" << std::endl;
-         ts_first = std::chrono::steady_clock::now();
-      }
+/// A column of the ntuple direct path, read chunk-wise from the chunk sources, if any
+template <typename T>
+static ChunkView<T, ColumnProfiler::View<T>> GetChunkView(ChunkSources *sources, ColumnProfiler *profiler,
+   ROOT::Experimental::RNTupleReader *ntuple, const std::string &name)
+{
+   using RNTupleView = ROOT::Experimental::RNTupleView<T>;
+
+   ChunkView<T, ColumnProfiler::View<T>> view(
+      ColumnProfiler::GetView<T>(profiler, ntuple, name), name, ntuple->GetNEntries());
+   if (sources->fCache)
+      view.SetCache(sources->fCache.get(), sources->fFileKey);
+   if (sources->fPool) {
+      // Every pool thread creates its view of the column on its own reader
+      auto threadViews = std::make_shared<std::vector<std::unique_ptr<RNTupleView>>>(sources->fPoolReaders.size());
+      auto readers = &sources->fPoolReaders;
+      view.SetPool(sources->fPool.get(),
+         [threadViews, readers, name](unsigned threadId, std::uint64_t first, std::uint64_t n, T *values) {
+            auto &threadView = (*threadViews)[threadId];
+            if (!threadView)
+               threadView.reset(new RNTupleView((*readers)[threadId]->GetView<T>(name)));
+            for (std::uint64_t i = 0; i < n; ++i)
+               values[i] = (*threadView)(first + i);
+         }, sources->fPoolLayout);
+   }
+   return view;
+}
+
+
+/// One node per cut and per derived quantity
+static ROOT::RDF::RResultPtr<TH1D> BuildGraph(ROOT::RDataFrame &frame, SlotMonitor *monitor)
+{
+   auto fn_muon_cut_and_stopwatch = [monitor](unsigned int slot, ULong64_t entry, int is_muon) {
+      monitor->Tick(slot, entry);
       return !is_muon;
    };
    auto fn_muon_cut = [](int is_muon) { return !is_muon; };
@@ -120,15 +295,68 @@ static void Dataframe(ROOT::RDataFrame &frame)
                            .Define("K3_E", GetKE, {"H3_PX", "H3_PY", "H3_PZ"})
                            .Define("B_E", fn_sum, {"K1_E", "K2_E", "K3_E"})
                            .Define("B_m", fn_mass, {"B_E", "B_P2"});
-   auto hMass = df_mass.Histo1D<double>({"B_mass", "", 500, 5050, 5500}, "B_m");
+   return df_mass.Histo1D<double>({"B_mass", "", 500, 5050, 5500}, "B_m");
+}
+
+
+/**
+ * The same computation in two nodes (-f): one filter evaluates all cuts in the order of the original graph, and one
+ * define computes the B mass.  RDataFrame evaluates the define, and reads the momenta, only for the entries that
+ * pass the filter, so the fused graph reads the same columns as the original one with a fifth of its nodes.
+ */
+static ROOT::RDF::RResultPtr<TH1D> BuildFusedGraph(ROOT::RDataFrame &frame, SlotMonitor *monitor)
+{
+   auto fn_cuts = [monitor](unsigned int slot, ULong64_t entry,
+                            int h1_is_muon, int h2_is_muon, int h3_is_muon,
+                            double h1_prob_k, double h2_prob_k, double h3_prob_k,
+                            double h1_prob_pi, double h2_prob_pi, double h3_prob_pi)
+   {
+      monitor->Tick(slot, entry);
+      if (h1_is_muon || h2_is_muon || h3_is_muon)
+         return false;
+      if (!(h1_prob_k > kProbKCut && h2_prob_k > kProbKCut && h3_prob_k > kProbKCut))
+         return false;
+      return h1_prob_pi < kProbPiCut && h2_prob_pi < kProbPiCut && h3_prob_pi < kProbPiCut;
+   };
+   auto fn_mass = [](double h1_px, double h1_py, double h1_pz,
+                     double h2_px, double h2_py, double h2_pz,
+                     double h3_px, double h3_py, double h3_pz)
+   {
+      double b_p2 = GetP2(h1_px + h2_px + h3_px, h1_py + h2_py + h3_py, h1_pz + h2_pz + h3_pz);
+      double b_E = GetKE(h1_px, h1_py, h1_pz) + GetKE(h2_px, h2_py, h2_pz) + GetKE(h3_px, h3_py, h3_pz);
+      return sqrt(b_E*b_E - b_p2);
+   };
+
+   auto df_mass = frame.Filter(fn_cuts, {"rdfslot_", "rdfentry_",
+                                         "H1_isMuon", "H2_isMuon", "H3_isMuon",
+                                         "H1_ProbK", "H2_ProbK", "H3_ProbK",
+                                         "H1_ProbPi", "H2_ProbPi", "H3_ProbPi"})
+                       .Define("B_m", fn_mass, {"H1_PX", "H1_PY", "H1_PZ",
+                                                "H2_PX", "H2_PY", "H2_PZ",
+                                                "H3_PX", "H3_PY", "H3_PZ"});
+   return df_mass.Histo1D<double>({"B_mass", "", 500, 5050, 5500}, "B_m");
+}
 
+
+static void Dataframe(ROOT::RDataFrame &frame)
+{
+   auto ts_init = std::chrono::steady_clock::now();
+
+   SlotMonitor monitor(ROOT::IsImplicitMTEnabled() ? ROOT::GetImplicitMTPoolSize() : 1, g_slot_balance);
+   auto hMass = g_rdf_fused ? BuildFusedGraph(frame, &monitor) : BuildGraph(frame, &monitor);
    *hMass;
    auto ts_end = std::chrono::steady_clock::now();
+   auto ts_first = monitor.GetTsFirst();
    auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
    auto runtime_analyze = std::chrono::duration_cast<std::chrono::microseconds>(ts_end - ts_first).count();
    std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
+   monitor.Print(ts_end);
+   // The implicit MT threads are not pinned; reported like the -t and -U runners
+   NumaPlacement(false).Print();
 
+   if (!g_result_path.empty())
+      WriteResult(hMass.GetPtr());
    if (g_show)
       Show(hMass.GetPtr());
 }
@@ -136,12 +364,19 @@ static void Dataframe(ROOT::RDataFrame &frame)
 
 static void TreeDirect(const std::string &path) {
    auto ts_init = std::chrono::steady_clock::now();
+   g_tree_unzip.Enable();
 
-   auto file = TFile::Open(path.c_str());
+   std::unique_ptr<BlockCache> blockCache;
+   if (!g_block_cache_dir.empty())
+      blockCache.reset(new BlockCache(g_block_cache_dir, g_block_cache_limit));
+   auto file = CachedWebFile::Open(path, blockCache.get());
    auto tree = file->Get<TTree>("DecayTree");
    TTreePerfStats *ps = nullptr;
    if (g_perf_stats)
       ps = new TTreePerfStats("ioperf", tree);
+   // Read the first cluster of the profiled branches before the branch addresses are set up
+   if (!g_prefetch_profile_path.empty())
+      ColumnProfiler::Prefetch(tree, ColumnProfiler::LoadColumns(g_prefetch_profile_path));
 
    TBranch *br_h1_px = nullptr;
    TBranch *br_h1_py = nullptr;
@@ -199,54 +434,72 @@ static void TreeDirect(const std::string &path) {
    tree->SetBranchAddress("H3_ProbK",  &h3_prob_k,  &br_h3_prob_k);
    tree->SetBranchAddress("H3_ProbPi", &h3_prob_pi, &br_h3_prob_pi);
    tree->SetBranchAddress("H3_isMuon", &h3_is_muon, &br_h3_is_muon);
+   const std::vector<TBranch *> cutBranches{br_h1_prob_k, br_h1_prob_pi, br_h1_is_muon,
+                                            br_h2_prob_k, br_h2_prob_pi, br_h2_is_muon,
+                                            br_h3_prob_k, br_h3_prob_pi, br_h3_is_muon};
+   const std::vector<TBranch *> lateBranches{br_h1_px, br_h1_py, br_h1_pz, br_h2_px, br_h2_py, br_h2_pz,
+                                             br_h3_px, br_h3_py, br_h3_pz};
+   if (g_late_materialization) {
+      // The momenta bypass the tree cache, so that their baskets without selected entries are not read
+      g_tree_cache.ApplyExclusive(tree, cutBranches);
+   } else {
+      auto branches = cutBranches;
+      branches.insert(branches.end(), lateBranches.begin(), lateBranches.end());
+      g_tree_cache.Apply(tree, branches);
+   }
+   g_tree_unzip.Apply(tree);
 
    auto hMass = new TH1D("B_mass", "", 500, 5050, 5500);
+   auto zoneMap = LoadZoneMap();
+   std::unique_ptr<SkimList> skimList;
+   std::unique_ptr<SkimList> skimRecord;
+   OpenSkimList(path, &skimList, &skimRecord);
+   auto profiler = CreateProfiler();
+
+   // Reads a branch entry, through the column access profiler with -a
+   auto fnGetEntry = [&profiler](TBranch *branch, Long64_t entry) {
+      if (profiler)
+         profiler->GetEntry(branch, entry);
+      else
+         branch->GetEntry(entry);
+   };
 
-   auto nEntries = tree->GetEntries();
-   std::chrono::steady_clock::time_point ts_first;
-   for (decltype(nEntries) entryId = 0; entryId < nEntries; ++entryId) {
-      if ((entryId % 100000) == 0) {
-         printf("processed %llu k events\n", entryId / 1000);
-         //printf("dummy is %lf\n", dummy); abort();
-      }
-      if (entryId == 1) {
-         ts_first = std::chrono::steady_clock::now();
-      }
+   // The particle identification cuts, evaluated before any momentum is read; see kSkimCutVersion
+   auto fnSelect = [&](Long64_t entryId) {
+      fnGetEntry(br_h1_is_muon, entryId);
+      if (h1_is_muon) return false;
+      fnGetEntry(br_h2_is_muon, entryId);
+      if (h2_is_muon) return false;
+      fnGetEntry(br_h3_is_muon, entryId);
+      if (h3_is_muon) return false;
+
+      fnGetEntry(br_h1_prob_k, entryId);
+      if (h1_prob_k < kProbKCut) return false;
+      fnGetEntry(br_h2_prob_k, entryId);
+      if (h2_prob_k < kProbKCut) return false;
+      fnGetEntry(br_h3_prob_k, entryId);
+      if (h3_prob_k < kProbKCut) return false;
+
+      fnGetEntry(br_h1_prob_pi, entryId);
+      if (h1_prob_pi > kProbPiCut) return false;
+      fnGetEntry(br_h2_prob_pi, entryId);
+      if (h2_prob_pi > kProbPiCut) return false;
+      fnGetEntry(br_h3_prob_pi, entryId);
+      if (h3_prob_pi > kProbPiCut) return false;
+      return true;
+   };
 
-      tree->LoadTree(entryId);
-
-      br_h1_is_muon->GetEntry(entryId);
-      if (h1_is_muon) continue;
-      br_h2_is_muon->GetEntry(entryId);
-      if (h2_is_muon) continue;
-      br_h3_is_muon->GetEntry(entryId);
-      if (h3_is_muon) continue;
-
-      constexpr double prob_k_cut = 0.5;
-      br_h1_prob_k->GetEntry(entryId);
-      if (h1_prob_k < prob_k_cut) continue;
-      br_h2_prob_k->GetEntry(entryId);
-      if (h2_prob_k < prob_k_cut) continue;
-      br_h3_prob_k->GetEntry(entryId);
-      if (h3_prob_k < prob_k_cut) continue;
-
-      constexpr double prob_pi_cut = 0.5;
-      br_h1_prob_pi->GetEntry(entryId);
-      if (h1_prob_pi > prob_pi_cut) continue;
-      br_h2_prob_pi->GetEntry(entryId);
-      if (h2_prob_pi > prob_pi_cut) continue;
-      br_h3_prob_pi->GetEntry(entryId);
-      if (h3_prob_pi > prob_pi_cut) continue;
-
-      br_h1_px->GetEntry(entryId);
-      br_h1_py->GetEntry(entryId);
-      br_h1_pz->GetEntry(entryId);
-      br_h2_px->GetEntry(entryId);
-      br_h2_py->GetEntry(entryId);
-      br_h2_pz->GetEntry(entryId);
-      br_h3_px->GetEntry(entryId);
-      br_h3_py->GetEntry(entryId);
-      br_h3_pz->GetEntry(entryId);
+   // Reads the momenta of a selected entry through fnGetEntry(branch, entryId) and fills the B mass
+   auto fnFill = [&](Long64_t entryId, auto &&fnGetEntry) {
+      fnGetEntry(br_h1_px, entryId);
+      fnGetEntry(br_h1_py, entryId);
+      fnGetEntry(br_h1_pz, entryId);
+      fnGetEntry(br_h2_px, entryId);
+      fnGetEntry(br_h2_py, entryId);
+      fnGetEntry(br_h2_pz, entryId);
+      fnGetEntry(br_h3_px, entryId);
+      fnGetEntry(br_h3_py, entryId);
+      fnGetEntry(br_h3_pz, entryId);
 
       double b_px = h1_px + h2_px + h3_px;
       double b_py = h1_py + h2_py + h3_py;
@@ -260,7 +513,70 @@ static void TreeDirect(const std::string &path) {
       hMass->Fill(b_mass);
 
       //printf("BMASS %lf\n", b_mass);
+   };
+
+   // The momentum baskets touched by the selected entries, counted in the -L mode
+   BasketCounter basketCounter(g_late_materialization, lateBranches);
+   auto fnGetLateEntry = [&](TBranch *branch, Long64_t entry) {
+      basketCounter.Count(branch, entry);
+      fnGetEntry(branch, entry);
+   };
+
+   auto nEntries = tree->GetEntries();
+   std::chrono::steady_clock::time_point ts_first;
+   if (skimList) {
+      // Only the preselected entries, the cut branches are not read
+      ts_first = std::chrono::steady_clock::now();
+      skimList->ForEach([&](std::uint64_t entryId) {
+         tree->LoadTree(entryId);
+         fnFill(entryId, fnGetEntry);
+      });
+   } else if (!g_late_materialization) {
+      for (decltype(nEntries) entryId = 0; entryId < nEntries; ++entryId) {
+         if ((entryId % 100000) == 0) {
+            printf("processed %llu k events\n", entryId / 1000);
+            //printf("dummy is %lf\n", dummy); abort();
+         }
+         if (entryId == 1) {
+            ts_first = std::chrono::steady_clock::now();
+         }
+
+         if (zoneMap && !zoneMap->IsSelected(entryId)) continue;
+
+         tree->LoadTree(entryId);
+         if (!fnSelect(entryId)) continue;
+         if (skimRecord) skimRecord->Add(entryId);
+         fnFill(entryId, fnGetEntry);
+      }
+   } else {
+      // Two passes per cluster: the selection on all entries, then the momenta of the surviving entries
+      std::vector<Long64_t> survivors;
+      auto clusterItr = tree->GetClusterIterator(0);
+      Long64_t clusterStart;
+      while ((clusterStart = clusterItr.Next()) < nEntries) {
+         auto clusterEnd = clusterItr.GetNextEntry();
+         survivors.clear();
+         for (auto entryId = clusterStart; entryId < clusterEnd; ++entryId) {
+            if ((entryId % 100000) == 0)
+               printf("processed %llu k events\n", entryId / 1000);
+            if (entryId == 1)
+               ts_first = std::chrono::steady_clock::now();
+            if (zoneMap && !zoneMap->IsSelected(entryId))
+               continue;
+
+            tree->LoadTree(entryId);
+            if (fnSelect(entryId))
+               survivors.push_back(entryId);
+         }
+         for (auto entryId : survivors) {
+            if (skimRecord)
+               skimRecord->Add(entryId);
+            fnFill(entryId, fnGetLateEntry);
+         }
+      }
    }
+   SaveSkimList(skimRecord.get());
+   SaveProfile(profiler.get());
 
    auto ts_end = std::chrono::steady_clock::now();
    auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
@@ -268,9 +584,17 @@ static void TreeDirect(const std::string &path) {
 
    std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
+   if (!skimList)
+      basketCounter.Print();
+   if (blockCache)
+      blockCache->PrintStats();
 
-   if (g_perf_stats)
+   if (g_perf_stats) {
       ps->Print();
+      TreeCacheConfig::PrintStats(tree);
+   }
+   if (!g_result_path.empty())
+      WriteResult(hMass);
    if (g_show) {
       Show(hMass);
    }
@@ -285,63 +609,80 @@ static void NTupleDirect(const std::string &path)
    using RNTupleModel = ROOT::Experimental::RNTupleModel;
 
    auto ts_init = std::chrono::steady_clock::now();
+   // The analysis thread stays on its node, together with the decode pool and the buffers of both
+   NumaPlacement placement(g_numa_placement);
+   auto node = placement.GetCurrentNode();
+   placement.PinThread(node);
 
    auto model = RNTupleModel::Create();
    //auto options = GetRNTupleOptions();
    auto ntuple = RNTupleReader::Open(std::move(model), "DecayTree", path);
    if (g_perf_stats)
       ntuple->EnableMetrics();
+   auto profiler = CreateProfiler();
+
+   ChunkSources chunkSources;
+   if (g_shm_cache_size > 0) {
+      chunkSources.fCache.reset(new ShmChunkCache(kShmCacheName, g_shm_cache_size));
+      chunkSources.fFileKey = ShmChunkCache::GetFileKey(path);
+   } else if (g_chunk_file_size > 0) {
+      // Persistent decoded chunks next to the input file, reset if the input file changed
+      chunkSources.fFileKey = ShmChunkCache::GetFileKey(path);
+      chunkSources.fCache.reset(new ShmChunkCache(path + ".chunks", g_chunk_file_size,
+                                                  ShmChunkCache::EBacking::kFile, chunkSources.fFileKey));
+   }
+   if (g_decode_threads > 0) {
+      for (unsigned i = 0; i < g_decode_threads; ++i)
+         chunkSources.fPoolReaders.emplace_back(RNTupleReader::Open(RNTupleModel::Create(), "DecayTree", path));
+      chunkSources.fPoolLayout = std::make_shared<ChunkLayout>(ntuple->GetNEntries(), GetClusterStarts(ntuple.get()));
+      chunkSources.fPool.reset(new DecodePool(g_decode_threads, &placement, node));
+   }
 
-   auto viewH1IsMuon = ntuple->GetView<int>("H1_isMuon");
-   auto viewH2IsMuon = ntuple->GetView<int>("H2_isMuon");
-   auto viewH3IsMuon = ntuple->GetView<int>("H3_isMuon");
+   auto viewH1IsMuon = GetChunkView<int>(&chunkSources, profiler.get(), ntuple.get(), "H1_isMuon");
+   auto viewH2IsMuon = GetChunkView<int>(&chunkSources, profiler.get(), ntuple.get(), "H2_isMuon");
+   auto viewH3IsMuon = GetChunkView<int>(&chunkSources, profiler.get(), ntuple.get(), "H3_isMuon");
 
-   auto viewH1PX = ntuple->GetView<double>("H1_PX");
-   auto viewH1PY = ntuple->GetView<double>("H1_PY");
-   auto viewH1PZ = ntuple->GetView<double>("H1_PZ");
-   auto viewH1ProbK = ntuple->GetView<double>("H1_ProbK");
-   auto viewH1ProbPi = ntuple->GetView<double>("H1_ProbPi");
+   auto viewH1PX = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H1_PX");
+   auto viewH1PY = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H1_PY");
+   auto viewH1PZ = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H1_PZ");
+   auto viewH1ProbK = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H1_ProbK");
+   auto viewH1ProbPi = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H1_ProbPi");
 
-   auto viewH2PX = ntuple->GetView<double>("H2_PX");
-   auto viewH2PY = ntuple->GetView<double>("H2_PY");
-   auto viewH2PZ = ntuple->GetView<double>("H2_PZ");
-   auto viewH2ProbK = ntuple->GetView<double>("H2_ProbK");
-   auto viewH2ProbPi = ntuple->GetView<double>("H2_ProbPi");
+   auto viewH2PX = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H2_PX");
+   auto viewH2PY = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H2_PY");
+   auto viewH2PZ = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H2_PZ");
+   auto viewH2ProbK = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H2_ProbK");
+   auto viewH2ProbPi = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H2_ProbPi");
 
-   auto viewH3PX = ntuple->GetView<double>("H3_PX");
-   auto viewH3PY = ntuple->GetView<double>("H3_PY");
-   auto viewH3PZ = ntuple->GetView<double>("H3_PZ");
-   auto viewH3ProbK = ntuple->GetView<double>("H3_ProbK");
-   auto viewH3ProbPi = ntuple->GetView<double>("H3_ProbPi");
+   auto viewH3PX = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H3_PX");
+   auto viewH3PY = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H3_PY");
+   auto viewH3PZ = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H3_PZ");
+   auto viewH3ProbK = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H3_ProbK");
+   auto viewH3ProbPi = GetChunkView<double>(&chunkSources, profiler.get(), ntuple.get(), "H3_ProbPi");
 
    auto hMass = new TH1D("B_mass", "", 500, 5050, 5500);
+   auto zoneMap = LoadZoneMap();
+   std::unique_ptr<SkimList> skimList;
+   std::unique_ptr<SkimList> skimRecord;
+   OpenSkimList(path, &skimList, &skimRecord);
 
-   unsigned nevents = 0;
-   std::chrono::steady_clock::time_point ts_first;
-   for (auto i : ntuple->GetEntryRange()) {
-      nevents++;
-      if ((nevents % 100000) == 0) {
-         printf("processed %u k events\n", nevents / 1000);
-         //printf("dummy is %lf\n", dummy); abort();
-      }
-      if (nevents == 1) {
-         ts_first = std::chrono::steady_clock::now();
-      }
-
+   // See kSkimCutVersion
+   auto fnSelect = [&](std::uint64_t i) {
       if (viewH1IsMuon(i) || viewH2IsMuon(i) || viewH3IsMuon(i)) {
-         continue;
+         return false;
       }
 
-      constexpr double prob_k_cut = 0.5;
-      if (viewH1ProbK(i) < prob_k_cut) continue;
-      if (viewH2ProbK(i) < prob_k_cut) continue;
-      if (viewH3ProbK(i) < prob_k_cut) continue;
+      if (viewH1ProbK(i) < kProbKCut) return false;
+      if (viewH2ProbK(i) < kProbKCut) return false;
+      if (viewH3ProbK(i) < kProbKCut) return false;
 
-      constexpr double prob_pi_cut = 0.5;
-      if (viewH1ProbPi(i) > prob_pi_cut) continue;
-      if (viewH2ProbPi(i) > prob_pi_cut) continue;
-      if (viewH3ProbPi(i) > prob_pi_cut) continue;
+      if (viewH1ProbPi(i) > kProbPiCut) return false;
+      if (viewH2ProbPi(i) > kProbPiCut) return false;
+      if (viewH3ProbPi(i) > kProbPiCut) return false;
+      return true;
+   };
 
+   auto fnFill = [&](std::uint64_t i) {
       double b_px = viewH1PX(i) + viewH2PX(i) + viewH3PX(i);
       double b_py = viewH1PY(i) + viewH2PY(i) + viewH3PY(i);
       double b_pz = viewH1PZ(i) + viewH2PZ(i) + viewH3PZ(i);
@@ -352,16 +693,50 @@ static void NTupleDirect(const std::string &path)
       double b_E = k1_E + k2_E + k3_E;
       double b_mass = sqrt(b_E*b_E - b_p2);
       hMass->Fill(b_mass);
+   };
+
+   std::chrono::steady_clock::time_point ts_first;
+   if (skimList) {
+      ts_first = std::chrono::steady_clock::now();
+      skimList->ForEach(fnFill);
+   } else {
+      unsigned nevents = 0;
+      for (auto i : ntuple->GetEntryRange()) {
+         nevents++;
+         if ((nevents % 100000) == 0) {
+            printf("processed %u k events\n", nevents / 1000);
+            //printf("dummy is %lf\n", dummy); abort();
+         }
+         if (nevents == 1) {
+            ts_first = std::chrono::steady_clock::now();
+         }
+         if (zoneMap && !zoneMap->IsSelected(i)) continue;
+
+         if (!fnSelect(i)) continue;
+         if (skimRecord) skimRecord->Add(i);
+         fnFill(i);
+      }
    }
+   SaveSkimList(skimRecord.get());
+   SaveProfile(profiler.get());
+
    auto ts_end = std::chrono::steady_clock::now();
    auto runtime_init = std::chrono::duration_cast<std::chrono::microseconds>(ts_first - ts_init).count();
    auto runtime_analyze = std::chrono::duration_cast<std::chrono::microseconds>(ts_end - ts_first).count();
 
    std::cout << "Runtime-Initialization: " << runtime_init << "us" << std::endl;
    std::cout << "Runtime-Analysis: " << runtime_analyze << "us" << std::endl;
+   if (chunkSources.fCache)
+      chunkSources.fCache->PrintStats();
+   if (chunkSources.fPool) {
+      placement.Print();
+      chunkSources.fPool->PrintStats();
+   }
 
    if (g_perf_stats)
       ntuple->PrintInfo(ROOT::Experimental::ENTupleInfo::kMetrics);
+   if (!g_result_path.empty())
+      WriteResult(hMass);
    if (g_show)
       Show(hMass);
 
@@ -370,7 +745,18 @@ static void NTupleDirect(const std::string &path)
 
 
 static void Usage(const char *progname) {
-  printf("%s [-i input.root] [-r(df)] [-m(t)] [-p(erformance stats)] [-s(show)]\n", progname);
+  printf("%s [-i input.root] [-r(df)] [-m(t)] [-p(erformance stats)] [-s(show)] [-o result.root]\n"
+         "   [-f(used rdf graph, implies -r)] [-b(alance report per processing slot, rdf only)]\n"
+         "   [-L(ate materialization, TTree direct only)] [-z zone map (direct only)]\n"
+         "   [-S(kim list cache, direct only)] [-a column access profile (direct only)]\n"
+         "   [-w prefetch list from a column access profile (TTree direct only)]\n"
+         "   [-C block cache directory[,size limit in MB] (TTree direct over HTTP only)]\n"
+         "   [-T tree cache size in MB[,fill] (TTree direct only)]\n"
+         "   [-Z unzip threads[,unzip budget in MB] (TTree direct only)]\n"
+         "   [-M shared chunk cache size in MB (ntuple direct only)]\n"
+         "   [-D persistent chunk cache file size in MB (ntuple direct only)]\n"
+         "   [-U decode pool threads (ntuple direct only)]\n"
+         "   [-N(UMA placement of the -U decode pool)]\n", progname);
 }
 
 
@@ -381,7 +767,7 @@ int main(int argc, char **argv) {
    std::string input_suffix;
    bool use_rdf = false;
    int c;
-   while ((c = getopt(argc, argv, "hvi:rpsm")) != -1) {
+   while ((c = getopt(argc, argv, "hvi:rfbpsmo:Lz:Sa:w:C:M:D:U:NT:Z:")) != -1) {
       switch (c) {
       case 'h':
       case 'v':
@@ -402,6 +788,56 @@ int main(int argc, char **argv) {
       case 'r':
          use_rdf = true;
          break;
+      case 'f':
+         g_rdf_fused = true;
+         use_rdf = true;
+         break;
+      case 'b':
+         g_slot_balance = true;
+         break;
+      case 'o':
+         g_result_path = optarg;
+         break;
+      case 'L':
+         g_late_materialization = true;
+         break;
+      case 'z':
+         g_zone_map_path = optarg;
+         break;
+      case 'S':
+         g_skim_list = true;
+         break;
+      case 'a':
+         g_access_profile_path = optarg;
+         break;
+      case 'w':
+         g_prefetch_profile_path = optarg;
+         break;
+      case 'C': {
+         auto cacheSpec = SplitString(optarg, ',');
+         g_block_cache_dir = cacheSpec[0];
+         if (cacheSpec.size() > 1)
+            g_block_cache_limit = String2Uint64(cacheSpec[1]) * 1024 * 1024;
+         break;
+      }
+      case 'M':
+         g_shm_cache_size = String2Uint64(optarg) * 1024 * 1024;
+         break;
+      case 'D':
+         g_chunk_file_size = String2Uint64(optarg) * 1024 * 1024;
+         break;
+      case 'U':
+         g_decode_threads = String2Uint64(optarg);
+         break;
+      case 'N':
+         g_numa_placement = true;
+         break;
+      case 'T':
+         g_tree_cache = TreeCacheConfig::Parse(optarg);
+         break;
+      case 'Z':
+         g_tree_unzip = TreeUnzipConfig::Parse(optarg);
+         break;
       default:
          fprintf(stderr, "Unknown option: -%c\n", c);
          Usage(argv[0]);
@@ -412,8 +848,28 @@ int main(int argc, char **argv) {
       Usage(argv[0]);
       return 1;
    }
+   if ((g_shm_cache_size > 0) + (g_chunk_file_size > 0) + (g_decode_threads > 0) > 1) {
+      fprintf(stderr, "-M, -D, and -U are mutually exclusive\n");
+      return 1;
+   }
+   if (g_numa_placement && (g_decode_threads == 0)) {
+      fprintf(stderr, "-N requires -U\n");
+      return 1;
+   }
+   if (g_tree_cache.IsSet() && !g_prefetch_profile_path.empty()) {
+      fprintf(stderr, "-T and -w are mutually exclusive\n");
+      return 1;
+   }
+   if (g_tree_cache.IsDisabled() && g_tree_unzip.IsSet()) {
+      fprintf(stderr, "-Z requires a tree cache, it cannot be combined with -T 0\n");
+      return 1;
+   }
 
    auto suffix = GetSuffix(input_path);
+   if (!g_prefetch_profile_path.empty() && (use_rdf || (GetFileFormat(suffix) != FileFormats::kRoot))) {
+      fprintf(stderr, "-w requires the TTree direct path\n");
+      return 1;
+   }
    switch (GetFileFormat(suffix)) {
    case FileFormats::kRoot:
       if (use_rdf) {
@@ -0,0 +1,125 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include "numa.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+NumaPlacement::NumaPlacement(bool isEnabled) : fIsEnabled(isEnabled) {
+   // The CPUs the process may run on, e.g. restricted by a cpuset or taskset
+   cpu_set_t allowed;
+   CPU_ZERO(&allowed);
+   if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+      for (unsigned i = 0; i < std::thread::hardware_concurrency() && i < CPU_SETSIZE; ++i)
+         CPU_SET(i, &allowed);
+   }
+   auto fnIsAllowed = [&allowed](unsigned cpu) { return (cpu < CPU_SETSIZE) && CPU_ISSET(cpu, &allowed); };
+
+   for (unsigned node = 0; ; ++node) {
+      std::ifstream cpuList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      if (!cpuList)
+         break;
+      std::string line;
+      std::getline(cpuList, line);
+      std::vector<unsigned> cpus;
+      for (auto cpu : ParseCpuList(line)) {
+         if (fnIsAllowed(cpu))
+            cpus.push_back(cpu);
+      }
+      // Nodes outside the affinity mask do not receive threads
+      if (!cpus.empty())
+         fNodeCpus.emplace_back(cpus);
+   }
+   if (fNodeCpus.empty()) {
+      fNodeCpus.emplace_back();
+      for (unsigned i = 0; i < CPU_SETSIZE; ++i) {
+         if (fnIsAllowed(i))
+            fNodeCpus[0].push_back(i);
+      }
+   }
+}
+
+
+std::vector<unsigned> NumaPlacement::ParseCpuList(const std::string &cpuList) {
+   // Comma-separated CPUs and CPU ranges, e.g. "0-7,16-23"
+   std::vector<unsigned> cpus;
+   std::istringstream stream(cpuList);
+   std::string item;
+   while (std::getline(stream, item, ',')) {
+      if (item.empty())
+         continue;
+      auto dash = item.find('-');
+      unsigned first = std::stoul(item.substr(0, dash));
+      unsigned last = (dash == std::string::npos) ? first : std::stoul(item.substr(dash + 1));
+      for (auto cpu = first; cpu <= last; ++cpu)
+         cpus.push_back(cpu);
+   }
+   return cpus;
+}
+
+
+unsigned NumaPlacement::GetNode(unsigned workerId, unsigned nWorkers) const {
+   if (!fIsEnabled || nWorkers == 0)
+      return 0;
+   return static_cast<std::uint64_t>(workerId) * GetNNodes() / nWorkers;
+}
+
+
+unsigned NumaPlacement::GetCurrentNode() const {
+   if (!fIsEnabled)
+      return 0;
+   auto cpu = sched_getcpu();
+   for (unsigned node = 0; node < fNodeCpus.size(); ++node) {
+      for (auto c : fNodeCpus[node]) {
+         if (static_cast<int>(c) == cpu)
+            return node;
+      }
+   }
+   return 0;
+}
+
+
+void NumaPlacement::PinThread(unsigned node) const {
+   if (!fIsEnabled || fNodeCpus[node].empty())
+      return;
+   // Stay within the current mask of the thread, which may have been narrowed since the construction
+   cpu_set_t current;
+   if (pthread_getaffinity_np(pthread_self(), sizeof(current), &current) != 0)
+      return;
+   cpu_set_t cpuSet;
+   CPU_ZERO(&cpuSet);
+   for (auto cpu : fNodeCpus[node]) {
+      if (CPU_ISSET(cpu, &current))
+         CPU_SET(cpu, &cpuSet);
+   }
+   if (CPU_COUNT(&cpuSet) == 0)
+      return;
+   auto retval = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+   if (retval != 0) {
+      fprintf(stderr, "cannot pin thread to NUMA node %u: %s\n", node, strerror(retval));
+      abort();
+   }
+}
+
+
+void NumaPlacement::Print() const {
+   if (!fIsEnabled) {
+      std::cout << "NUMA-Placement: disabled" << std::endl;
+      return;
+   }
+   std::cout << "NUMA-Placement: enabled, " << GetNNodes() << " nodes (";
+   for (unsigned node = 0; node < fNodeCpus.size(); ++node)
+      std::cout << (node > 0 ? ", " : "") << fNodeCpus[node].size();
+   std::cout << " CPUs)" << std::endl;
+}
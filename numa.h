@@ -0,0 +1,42 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <string>
+#include <vector>
+
+/**
+ * Thread placement on the NUMA nodes of the machine, as listed in /sys/devices/system/node.  Pinned threads allocate
+ * their buffers on their own node by the kernel's first-touch policy, so a thread that is pinned before it opens its
+ * reader decompresses into node-local memory.  Workers are spread over the nodes in contiguous groups, such that
+ * neighboring workers, which process neighboring clusters, share a node.  Only the CPUs in the affinity mask of the
+ * process are used, and nodes without such CPUs are skipped, so that placement stays within a cpuset.  Without
+ * placement, or on a machine without NUMA information, all calls are no-ops and the machine counts as a single node.
+ */
+class NumaPlacement {
+   bool fIsEnabled;
+   /// The CPUs of every node
+   std::vector<std::vector<unsigned>> fNodeCpus;
+
+   static std::vector<unsigned> ParseCpuList(const std::string &cpuList);
+
+public:
+   explicit NumaPlacement(bool isEnabled);
+
+   bool IsEnabled() const { return fIsEnabled; }
+   unsigned GetNNodes() const { return fNodeCpus.size(); }
+   /// The node of worker workerId out of nWorkers
+   unsigned GetNode(unsigned workerId, unsigned nWorkers) const;
+   /// The node of the CPU the calling thread currently runs on
+   unsigned GetCurrentNode() const;
+   /// Restricts the calling thread to the CPUs of the given node that are in its current affinity mask; the thread
+   /// is left as is if there are none
+   void PinThread(unsigned node) const;
+   /// One line for the timing output, so that results state whether they were taken with placement
+   void Print() const;
+};
+
+#endif  // NUMA_H_
@@ -0,0 +1,86 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include "policy.h"
+
+#include <fnmatch.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "util.h"
+
+CompressionPolicy CompressionPolicy::Load(const std::string &path, int compression) {
+   CompressionPolicy policy(compression);
+   std::ifstream file(path);
+   if (!file) {
+      fprintf(stderr, "cannot open compression policy %s\n", path.c_str());
+      abort();
+   }
+
+   std::string line;
+   while (std::getline(file, line)) {
+      auto idxComment = line.find('#');
+      if (idxComment != std::string::npos)
+         line = line.substr(0, idxComment);
+      std::istringstream tokens(line);
+      std::string pattern;
+      std::string filterSpec;
+      std::string trailing;
+      if (!(tokens >> pattern))
+         continue;
+      if (!(tokens >> filterSpec)) {
+         fprintf(stderr, "missing filter for column pattern %s in %s\n", pattern.c_str(), path.c_str());
+         abort();
+      }
+      if (tokens >> trailing) {
+         fprintf(stderr, "unexpected '%s' for column pattern %s in %s, rules are '<pattern> <filter>'\n",
+                 trailing.c_str(), pattern.c_str(), path.c_str());
+         abort();
+      }
+      policy.fRules.push_back(Rule{pattern, ParseColumnFilter(filterSpec)});
+   }
+   return policy;
+}
+
+
+void CompressionPolicy::Resolve(const std::string &column, ColumnFilter *filter) {
+   Resolved resolved{column, ColumnFilter()};
+   for (const auto &r : fRules) {
+      if (fnmatch(r.fPattern.c_str(), column.c_str(), 0) == 0) {
+         resolved.fFilter = r.fFilter;
+         break;
+      }
+   }
+   if (!filter && !resolved.fFilter.IsEmpty()) {
+      fprintf(stderr, "cannot apply filter %s to column %s\n", resolved.fFilter.ToString().c_str(), column.c_str());
+      abort();
+   }
+   fResolved.emplace_back(resolved);
+   if (filter)
+      *filter = resolved.fFilter;
+}
+
+
+void CompressionPolicy::CheckApplicable() const {
+   for (const auto &r : fRules) {
+      if (r.fFilter.fShuffle || r.fFilter.fDelta) {
+         fprintf(stderr, "cannot apply filter %s to column pattern %s, the readers cannot decode it; "
+                 "use bm_codec to evaluate it\n", r.fFilter.ToString().c_str(), r.fPattern.c_str());
+         abort();
+      }
+   }
+}
+
+
+void CompressionPolicy::WriteMetadata(const std::string &path) const {
+   std::ofstream file(path, std::ofstream::out | std::ofstream::trunc);
+   file << "# compression " << fCompression << " for all columns" << std::endl;
+   file << "# column filter" << std::endl;
+   for (const auto &r : fResolved)
+      file << r.fColumn << " " << r.fFilter.ToString() << std::endl;
+}
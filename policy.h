@@ -0,0 +1,57 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef POLICY_H_
+#define POLICY_H_
+
+#include <string>
+#include <vector>
+
+#include "filter.h"
+
+/**
+ * Per-column pre-compression filters, read from a text file with one rule per line:
+ *
+ *     # column pattern    filter
+ *     H*_P[XYZ]           trunc16
+ *     event.tracks.covar  trunc12
+ *
+ * Patterns are shell wildcards (fnmatch) on the column name.  The first matching rule wins; columns that match no
+ * rule are stored without a filter.  The filters are described in filter.h.  The ntuple page sink applies one
+ * compression setting to all columns, so the compression is not part of the rules; it is given to the constructor
+ * and recorded together with the resolved columns, so that the applied policy can be stored next to the generated
+ * file.
+ */
+class CompressionPolicy {
+public:
+   struct Rule {
+      std::string fPattern;
+      ColumnFilter fFilter;
+   };
+   struct Resolved {
+      std::string fColumn;
+      ColumnFilter fFilter;
+   };
+
+   explicit CompressionPolicy(int compression) : fCompression(compression) {}
+   static CompressionPolicy Load(const std::string &path, int compression);
+
+   /// Sets filter to the pre-compression filter of the column.  Callers that cannot apply filters pass no filter; a
+   /// rule with a filter for such a column aborts.
+   void Resolve(const std::string &column, ColumnFilter *filter = nullptr);
+   int GetCompression() const { return fCompression; }
+   bool IsEmpty() const { return fRules.empty(); }
+   /// The generators apply truncation only, see filter.h.  Aborts if any rule asks for byte shuffling or delta
+   /// encoding, so that a generated file is never labeled with a filter it was not written with.
+   void CheckApplicable() const;
+   /// Writes the compression and the resolved columns, one "column filter" pair per line
+   void WriteMetadata(const std::string &path) const;
+
+private:
+   std::vector<Rule> fRules;
+   int fCompression;
+   std::vector<Resolved> fResolved;
+};
+
+#endif  // POLICY_H_
@@ -0,0 +1,205 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <ROOT/RNTuple.hxx>
+#include <ROOT/RNTupleView.hxx>
+
+#include <TBasket.h>
+#include <TBranch.h>
+#include <TMath.h>
+#include <TTree.h>
+#include <TTreeCache.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "treecache.h"
+
+/**
+ * Per-column access statistics of an analysis run (-a <profile>): the number of entries read, the number of
+ * decompressed bytes, the number of pages (baskets for TTree) touched, and the time spent in reading.  Tree
+ * branches are read through GetEntry(), ntuple columns through the views returned by GetView().  The profile is
+ * written as a text file with one "column entries bytes pages time_us" line per accessed column, in the order of
+ * first access, so that it can be replayed as a prefetch list.  For ntuple columns, bytes and pages are estimates.
+ */
+class ColumnProfiler {
+public:
+   /// The ntuple generators keep the default page size of RNTupleWriteOptions.  The views do not expose the actual
+   /// pages, so the page and byte counts of ntuple columns are estimates based on this page size.
+   static constexpr std::uint64_t kNTupleElementsPerPage = 10000;
+
+   struct ColumnStats {
+      std::string fName;
+      std::uint64_t fNEntries = 0;
+      std::uint64_t fNBytes = 0;
+      std::uint64_t fNPages = 0;
+      std::chrono::nanoseconds fTime{0};
+      std::int64_t fLastPage = -1;
+      unsigned fFirstAccess = 0;
+      /// Pages and bytes derived from kNTupleElementsPerPage rather than from the actual pages
+      bool fIsEstimate = false;
+   };
+
+   /// An ntuple view that records its accesses in the column statistics, if there are any
+   template <typename T>
+   class View {
+      ROOT::Experimental::RNTupleView<T> fView;
+      ColumnProfiler *fProfiler;
+      ColumnStats *fStats;
+
+   public:
+      View(ROOT::Experimental::RNTupleView<T> &&view, ColumnProfiler *profiler, ColumnStats *stats)
+         : fView(std::move(view)), fProfiler(profiler), fStats(stats) {}
+
+      T operator()(ROOT::Experimental::NTupleSize_t index) {
+         if (!fStats)
+            return fView(index);
+         auto ts_start = std::chrono::steady_clock::now();
+         T value = fView(index);
+         auto ts_end = std::chrono::steady_clock::now();
+         std::int64_t page = index / kNTupleElementsPerPage;
+         fProfiler->Record(fStats, page, kNTupleElementsPerPage * sizeof(T), ts_end - ts_start);
+         return value;
+      }
+   };
+
+   /// Without a profiler, the view reads directly
+   template <typename T>
+   static View<T> GetView(ColumnProfiler *profiler, ROOT::Experimental::RNTupleReader *ntuple,
+                          const std::string &name)
+   {
+      auto stats = profiler ? profiler->GetStats(name) : nullptr;
+      if (stats)
+         stats->fIsEstimate = true;
+      return View<T>(ntuple->GetView<T>(name), profiler, stats);
+   }
+
+   /// Reads the branch entry and records the access; a newly touched basket counts as decompressed
+   void GetEntry(TBranch *branch, Long64_t entry) {
+      auto &stats = fBranchStats[branch];
+      if (!stats)
+         stats = GetStats(branch->GetName());
+      auto ts_start = std::chrono::steady_clock::now();
+      branch->GetEntry(entry);
+      auto ts_end = std::chrono::steady_clock::now();
+      Long64_t basket = TMath::BinarySearch(branch->GetWriteBasket() + 1, branch->GetBasketEntry(), entry);
+      std::uint64_t basketBytes = 0;
+      if (basket != stats->fLastPage) {
+         auto b = branch->GetBasket(basket);
+         basketBytes = b ? b->GetObjlen() : 0;
+      }
+      Record(stats, basket, basketBytes, ts_end - ts_start);
+   }
+
+   ColumnStats *GetStats(const std::string &name) {
+      auto itr = fColumnIndex.find(name);
+      if (itr != fColumnIndex.end())
+         return fColumns[itr->second].get();
+      fColumnIndex[name] = fColumns.size();
+      fColumns.emplace_back(new ColumnStats());
+      fColumns.back()->fName = name;
+      return fColumns.back().get();
+   }
+
+   void Print() const {
+      for (auto c : GetAccessed()) {
+         printf("Column-Access: %-40s %10llu entries %12llu bytes %6llu pages %10lld us%s\n", c->fName.c_str(),
+                static_cast<unsigned long long>(c->fNEntries), static_cast<unsigned long long>(c->fNBytes),
+                static_cast<unsigned long long>(c->fNPages),
+                static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(c->fTime).count()),
+                c->fIsEstimate ? " (bytes and pages estimated)" : "");
+      }
+   }
+
+   /// The column names of a saved profile in the order of first access
+   static std::vector<std::string> LoadColumns(const std::string &path) {
+      std::ifstream file(path);
+      if (!file) {
+         fprintf(stderr, "cannot read column access profile %s\n", path.c_str());
+         abort();
+      }
+      std::vector<std::string> columns;
+      std::string line;
+      while (std::getline(file, line)) {
+         auto name = line.substr(0, line.find(' '));
+         if (!name.empty())
+            columns.push_back(name);
+      }
+      return columns;
+   }
+
+   /**
+    * Replays the column set of a saved profile (-w <profile>) on a tree: the profiled branches are added to the
+    * tree cache and the learning phase is skipped, so that the baskets of the first cluster are requested at once
+    * and read in the background while the branch addresses are set up.  Profile columns that are not branches of
+    * the tree, e.g. the fields of an ntuple profile, are ignored.  The ntuple paths have no page prefetching
+    * interface to replay the profile on, so -w is restricted to the TTree direct path.
+    */
+   static void Prefetch(TTree *tree, const std::vector<std::string> &columns) {
+      tree->SetCacheSize(-1);
+      unsigned nBranches = 0;
+      for (const auto &c : columns) {
+         if (!tree->GetBranch(c.c_str()))
+            continue;
+         tree->AddBranchToCache(c.c_str());
+         nBranches++;
+      }
+      tree->StopCacheLearningPhase();
+      TreeCacheConfig::Prefill(tree);
+      std::cout << "Prefetch-List: " << nBranches << " of " << columns.size() << " profiled columns prefetched"
+                << std::endl;
+   }
+
+   void Save(const std::string &path) const {
+      std::ofstream file(path, std::ofstream::out | std::ofstream::trunc);
+      for (auto c : GetAccessed()) {
+         file << c->fName << " " << c->fNEntries << " " << c->fNBytes << " " << c->fNPages << " "
+              << std::chrono::duration_cast<std::chrono::microseconds>(c->fTime).count() << std::endl;
+      }
+   }
+
+private:
+   void Record(ColumnStats *stats, std::int64_t page, std::uint64_t pageBytes, std::chrono::nanoseconds time) {
+      if (stats->fNEntries == 0)
+         stats->fFirstAccess = fNAccessed++;
+      stats->fNEntries++;
+      stats->fTime += time;
+      if (page != stats->fLastPage) {
+         stats->fNPages++;
+         stats->fNBytes += pageBytes;
+         stats->fLastPage = page;
+      }
+   }
+
+   /// The accessed columns in the order of first access
+   std::vector<const ColumnStats *> GetAccessed() const {
+      std::vector<const ColumnStats *> result;
+      for (const auto &c : fColumns) {
+         if (c->fNEntries > 0)
+            result.push_back(c.get());
+      }
+      std::sort(result.begin(), result.end(),
+                [](const ColumnStats *a, const ColumnStats *b) { return a->fFirstAccess < b->fFirstAccess; });
+      return result;
+   }
+
+   std::vector<std::unique_ptr<ColumnStats>> fColumns;
+   std::map<std::string, std::size_t> fColumnIndex;
+   std::map<TBranch *, ColumnStats *> fBranchStats;
+   unsigned fNAccessed = 0;
+};
+
+#endif  // PROFILE_H_
@@ -0,0 +1,280 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include "shmcache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr std::uint32_t ShmChunkCache::kNSlots;
+constexpr std::uint64_t ShmChunkCache::kChunkSize;
+
+namespace {
+
+/// Changed with the layout of the segment, which makes older segments be initialized again
+constexpr std::uint64_t kMagic = 0x6368756e6b636164ULL;
+constexpr std::size_t kSlotSize = 40;
+constexpr std::uint64_t kAlignment = 64;
+
+/// FNV-1a, continued from hash
+std::uint64_t Hash(const void *buf, std::size_t size, std::uint64_t hash = 14695981039346656037ULL) {
+   auto bytes = reinterpret_cast<const unsigned char *>(buf);
+   for (std::size_t i = 0; i < size; ++i) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+/// FNV-1a over 64 bit words instead of bytes, fast enough to verify every chunk that is mapped from a file
+std::uint64_t GetChecksum(const void *buf, std::size_t size) {
+   auto bytes = reinterpret_cast<const unsigned char *>(buf);
+   std::uint64_t hash = 14695981039346656037ULL;
+   std::size_t nWords = size / sizeof(std::uint64_t);
+   for (std::size_t i = 0; i < nWords; ++i) {
+      std::uint64_t word;
+      memcpy(&word, bytes + i * sizeof(word), sizeof(word));
+      hash ^= word;
+      hash *= 1099511628211ULL;
+   }
+   return Hash(bytes + nWords * sizeof(std::uint64_t), size % sizeof(std::uint64_t), hash);
+}
+
+std::size_t GetIndexSize() {
+   auto size = sizeof(std::atomic<std::uint64_t>) * 4 + ShmChunkCache::kNSlots * kSlotSize;
+   auto pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+   return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+} // anonymous namespace
+
+
+ShmChunkCache::ShmChunkCache(const std::string &name, std::uint64_t dataSize, EBacking backing,
+                             std::uint64_t ownerKey)
+   : fName(name), fBacking(backing)
+{
+   static_assert(sizeof(Header) <= sizeof(std::atomic<std::uint64_t>) * 4, "header size");
+   static_assert(sizeof(Slot) <= kSlotSize, "slot size");
+   auto indexSize = GetIndexSize();
+
+   auto fnOpen = [this](int flags) {
+      if (fBacking == EBacking::kFile)
+         return open(fName.c_str(), flags, 0644);
+      return shm_open(fName.c_str(), flags, 0600);
+   };
+   auto fnStat = [this](int fd, struct stat *info) {
+      if (fstat(fd, info) != 0) {
+         fprintf(stderr, "cannot stat chunk cache segment %s: %s\n", fName.c_str(), strerror(errno));
+         abort();
+      }
+   };
+
+   // The segment is initialized under the lock.  If the initializing process dies, the lock is released and the
+   // next process finds the segment without magic and initializes it again, so nobody waits for a dead creator.
+   int fd;
+   bool isInitialized;
+   while (true) {
+      fd = fnOpen(O_RDWR | O_CREAT);
+      if (fd < 0) {
+         fprintf(stderr, "cannot open chunk cache segment %s: %s\n", fName.c_str(), strerror(errno));
+         abort();
+      }
+      if (flock(fd, LOCK_EX) != 0) {
+         fprintf(stderr, "cannot lock chunk cache segment %s: %s\n", fName.c_str(), strerror(errno));
+         abort();
+      }
+      struct stat info;
+      fnStat(fd, &info);
+      // While waiting for the lock, another process may have replaced the segment, see below
+      int current = fnOpen(O_RDWR);
+      bool isCurrent = false;
+      if (current >= 0) {
+         struct stat currentInfo;
+         fnStat(current, &currentInfo);
+         isCurrent = (currentInfo.st_dev == info.st_dev) && (currentInfo.st_ino == info.st_ino);
+         close(current);
+      }
+      if (!isCurrent) {
+         close(fd);
+         continue;
+      }
+
+      Header header;
+      isInitialized = (static_cast<std::size_t>(info.st_size) > indexSize) &&
+                      (pread(fd, &header, sizeof(header), 0) == sizeof(header)) && (header.fMagic == kMagic);
+      // The chunks of a previous version of the data file are never requested again
+      if (isInitialized && (ownerKey != 0) && (header.fOwnerKey != ownerKey)) {
+         std::cout << "Chunk cache " << fName << " belongs to a different data file, resetting" << std::endl;
+         dataSize = info.st_size - indexSize;
+         isInitialized = false;
+      }
+      if (isInitialized) {
+         dataSize = info.st_size - indexSize;
+         break;
+      }
+      if (info.st_size == 0)
+         break;
+      // A stale, old-layout, or partially initialized segment may still be mapped by other processes, which would
+      // fault if it were truncated.  It is unlinked instead and lives on until it is unmapped; the next round
+      // creates a new, empty segment.
+      Unlink(fName, fBacking);
+      flock(fd, LOCK_UN);
+      close(fd);
+   }
+   if (!isInitialized && (ftruncate(fd, indexSize + dataSize) != 0)) {
+      fprintf(stderr, "cannot size chunk cache segment %s: %s\n", fName.c_str(), strerror(errno));
+      abort();
+   }
+
+   fMapSize = indexSize + dataSize;
+   auto map = mmap(nullptr, fMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   auto data = mmap(nullptr, dataSize, PROT_READ, MAP_SHARED, fd, indexSize);
+   if (map == MAP_FAILED || data == MAP_FAILED) {
+      fprintf(stderr, "cannot map chunk cache segment %s: %s\n", fName.c_str(), strerror(errno));
+      abort();
+   }
+   fMap = static_cast<unsigned char *>(map);
+   fData = static_cast<const unsigned char *>(data);
+   fHeader = reinterpret_cast<Header *>(fMap);
+   fSlots = reinterpret_cast<Slot *>(fMap + sizeof(std::atomic<std::uint64_t>) * 4);
+
+   if (!isInitialized) {
+      // A fresh segment, also a sparse file, is zero-filled, i.e. all slots are empty
+      fHeader->fDataSize = dataSize;
+      fHeader->fNextOffset.store(0);
+      fHeader->fOwnerKey = ownerKey;
+      fHeader->fMagic.store(kMagic, std::memory_order_release);
+   }
+   flock(fd, LOCK_UN);
+   close(fd);
+}
+
+
+ShmChunkCache::~ShmChunkCache() {
+   munmap(const_cast<unsigned char *>(fData), fHeader->fDataSize);
+   munmap(fMap, fMapSize);
+}
+
+
+void ShmChunkCache::Unlink(const std::string &name, EBacking backing) {
+   if (backing == EBacking::kFile)
+      unlink(name.c_str());
+   else
+      shm_unlink(name.c_str());
+}
+
+
+std::uint64_t ShmChunkCache::GetFileKey(const std::string &path) {
+   struct stat info;
+   if (stat(path.c_str(), &info) != 0) {
+      fprintf(stderr, "the shared chunk cache requires a local file, cannot stat %s\n", path.c_str());
+      abort();
+   }
+   std::int64_t size = info.st_size;
+   std::int64_t mtime = info.st_mtime;
+   return Hash(&mtime, sizeof(mtime), Hash(&size, sizeof(size), Hash(path.data(), path.size())));
+}
+
+
+std::uint64_t ShmChunkCache::GetChunkKey(std::uint64_t fileKey, std::uint64_t chunkIdx, const std::string &column) {
+   auto key = Hash(column.data(), column.size(), Hash(&chunkIdx, sizeof(chunkIdx), fileKey));
+   // Zero marks an empty slot
+   return key ? key : 1;
+}
+
+
+ShmChunkCache::Slot *ShmChunkCache::Find(std::uint64_t key) {
+   for (std::uint32_t i = 0; i < kNSlots; ++i) {
+      auto slot = &fSlots[(key + i) % kNSlots];
+      auto slotKey = slot->fKey.load(std::memory_order_acquire);
+      if (slotKey == key)
+         return slot;
+      if (slotKey == 0)
+         return nullptr;
+   }
+   return nullptr;
+}
+
+
+const void *ShmChunkCache::Get(std::uint64_t key, std::uint64_t *size) {
+   auto slot = Find(key);
+   if (!slot || slot->fState.load(std::memory_order_acquire) != kReady) {
+      fNMisses++;
+      return nullptr;
+   }
+   if ((fBacking == EBacking::kFile) && (GetChecksum(fData + slot->fOffset, slot->fSize) != slot->fChecksum)) {
+      // Also the other processes decode the chunk privately from now on
+      std::uint32_t expected = kReady;
+      slot->fState.compare_exchange_strong(expected, kFailed, std::memory_order_acq_rel);
+      fNCorrupt++;
+      fNMisses++;
+      return nullptr;
+   }
+   fNHits++;
+   *size = slot->fSize;
+   return fData + slot->fOffset;
+}
+
+
+const void *ShmChunkCache::Insert(std::uint64_t key, std::uint64_t size, const std::function<void(void *)> &fnFill) {
+   Slot *slot = nullptr;
+   for (std::uint32_t i = 0; i < kNSlots; ++i) {
+      auto candidate = &fSlots[(key + i) % kNSlots];
+      std::uint64_t expected = 0;
+      if (candidate->fKey.compare_exchange_strong(expected, key, std::memory_order_acq_rel)) {
+         slot = candidate;
+         break;
+      }
+      // Claimed by another process in the meantime
+      if (expected == key)
+         return nullptr;
+   }
+   if (!slot)
+      return nullptr;
+
+   slot->fState.store(kFilling, std::memory_order_relaxed);
+   auto alignedSize = (size + kAlignment - 1) / kAlignment * kAlignment;
+   auto offset = fHeader->fNextOffset.fetch_add(alignedSize);
+   if (offset + alignedSize > fHeader->fDataSize) {
+      slot->fState.store(kFailed, std::memory_order_release);
+      return nullptr;
+   }
+   auto indexSize = fMapSize - fHeader->fDataSize;
+   auto buffer = fMap + indexSize + offset;
+   fnFill(buffer);
+   slot->fOffset = offset;
+   slot->fSize = size;
+   if (fBacking == EBacking::kFile) {
+      // The chunk must be on disk before the ready state can be, the checksum covers chunks lost nevertheless
+      slot->fChecksum = GetChecksum(buffer, size);
+      auto pageSize = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+      auto syncStart = (indexSize + offset) / pageSize * pageSize;
+      if (msync(fMap + syncStart, indexSize + offset + size - syncStart, MS_SYNC) != 0) {
+         slot->fState.store(kFailed, std::memory_order_release);
+         return nullptr;
+      }
+   }
+   slot->fState.store(kReady, std::memory_order_release);
+   fNInserted++;
+   return fData + offset;
+}
+
+
+void ShmChunkCache::PrintStats() const {
+   std::cout << ((fBacking == EBacking::kFile) ? "Chunk-File: " : "Shared-Cache: ") << fNHits << " hits, "
+             << fNMisses << " misses, " << fNInserted << " chunks inserted, ";
+   if (fBacking == EBacking::kFile)
+      std::cout << fNCorrupt << " corrupt, ";
+   std::cout << (fHeader->fNextOffset.load() / (1024 * 1024)) << " of " << (fHeader->fDataSize / (1024 * 1024))
+             << " MB used in " << fName << std::endl;
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef SHMCACHE_H_
+#define SHMCACHE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/**
+ * A node-wide cache of decoded column chunks in a POSIX shared memory segment, shared by concurrent analysis
+ * processes.  A chunk is keyed by the file identity, the chunk number and the column name.  The segment consists of
+ * a fixed-size, open-addressing index followed by the chunk data.  Index slots are claimed by compare-and-swap of
+ * the key; the claiming process allocates the chunk with an atomic bump pointer, fills it and then publishes it by
+ * setting the slot ready.  Other processes never block: until a chunk is ready, they decode it privately.  Ready
+ * chunks are handed out through a read-only mapping of the data area.  Chunks are never evicted; once the segment
+ * is full, further chunks are decoded privately.  The segment persists until it is removed with Unlink().  Only the
+ * initialization of the segment takes a lock (flock), so that a process that dies while initializing the segment
+ * does not leave the others waiting.
+ *
+ * The segment can also be a regular file, e.g. on local NVMe next to the data file.  Such a cache survives reboots,
+ * so that later runs map decoded chunks from the page cache or the disk instead of decompressing them again.  In a
+ * file, a chunk is synced to disk together with its checksum before it is set ready, and the checksum is verified
+ * on every lookup, so that a crash never exposes a partially written chunk.  The file records the owner key of the
+ * data file it was created for; if the data file changed, the stale chunks are discarded on open.  A stale segment is
+ * never truncated, as other processes may still map it; it is unlinked and replaced by a new segment.
+ */
+class ShmChunkCache {
+public:
+   static constexpr std::uint32_t kNSlots = 1 << 16;
+   /// Entries per chunk of a column
+   static constexpr std::uint64_t kChunkSize = 10000;
+
+   enum class EBacking { kSharedMemory, kFile };
+
+   /// For an existing segment, dataSize is ignored.  A segment with a different, non-zero owner key is reset.
+   ShmChunkCache(const std::string &name, std::uint64_t dataSize, EBacking backing = EBacking::kSharedMemory,
+                 std::uint64_t ownerKey = 0);
+   ShmChunkCache(const ShmChunkCache &other) = delete;
+   ShmChunkCache &operator =(const ShmChunkCache &other) = delete;
+   ~ShmChunkCache();
+
+   static void Unlink(const std::string &name, EBacking backing = EBacking::kSharedMemory);
+   /// Identifies a local file by its path, size and modification time
+   static std::uint64_t GetFileKey(const std::string &path);
+   static std::uint64_t GetChunkKey(std::uint64_t fileKey, std::uint64_t chunkIdx, const std::string &column);
+
+   /// Returns the chunk if it is ready or nullptr otherwise
+   const void *Get(std::uint64_t key, std::uint64_t *size);
+   /// Claims the chunk, fills it with fnFill(buffer) and returns it; returns nullptr if the chunk is claimed by
+   /// another process or if the segment is full
+   const void *Insert(std::uint64_t key, std::uint64_t size, const std::function<void(void *)> &fnFill);
+
+   std::uint64_t GetNHits() const { return fNHits; }
+   std::uint64_t GetNMisses() const { return fNMisses; }
+   void PrintStats() const;
+
+private:
+   enum EState : std::uint32_t { kEmpty = 0, kFilling, kReady, kFailed };
+   struct Header {
+      std::atomic<std::uint64_t> fMagic;
+      std::uint64_t fDataSize;
+      std::atomic<std::uint64_t> fNextOffset;
+      std::uint64_t fOwnerKey;
+   };
+   struct Slot {
+      std::atomic<std::uint64_t> fKey;
+      std::atomic<std::uint32_t> fState;
+      std::uint64_t fOffset;
+      std::uint64_t fSize;
+      /// Only set for file backing
+      std::uint64_t fChecksum;
+   };
+
+   /// The slot of the key or, if the key is not in the index, nullptr
+   Slot *Find(std::uint64_t key);
+
+   std::string fName;
+   EBacking fBacking;
+   std::size_t fMapSize = 0;
+   /// Header, index and data, writable
+   unsigned char *fMap = nullptr;
+   /// The data area, read-only
+   const unsigned char *fData = nullptr;
+   Header *fHeader = nullptr;
+   Slot *fSlots = nullptr;
+   std::uint64_t fNHits = 0;
+   std::uint64_t fNMisses = 0;
+   /// Chunks inserted by this process
+   std::uint64_t fNInserted = 0;
+   /// Ready chunks whose checksum did not match
+   std::uint64_t fNCorrupt = 0;
+};
+
+#endif  // SHMCACHE_H_
@@ -0,0 +1,168 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include <TBranch.h>
+#include <TFile.h>
+#include <TLeaf.h>
+#include <TTree.h>
+#include <TTreeFormula.h>
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "util.h"
+
+static void Usage(const char *progname) {
+   printf("%s -i <input.root> -o <output.root> [-t tree name] [-b branch1,branch2,...] [-x cut expression]\n"
+          "   [-c compression]\n"
+          "   writes a copy of the tree with only the given branches and only the entries that pass the cut\n"
+          "   (a TTree; gen_lhcb converts skims of flat trees, gen_h1 requires all branches of h42);\n"
+          "   the compressed baskets are reused only if all entries pass and no compression is given\n",
+          progname);
+}
+
+
+/// Enables the branch of the leaf and the branch of its leaf count, such that variable-size arrays can be read
+static void EnableLeaf(TTree *tree, TLeaf *leaf) {
+   tree->SetBranchStatus(leaf->GetBranch()->GetName(), 1);
+   if (auto leafCount = leaf->GetLeafCount())
+      tree->SetBranchStatus(leafCount->GetBranch()->GetName(), 1);
+}
+
+
+int main(int argc, char **argv) {
+   std::string inputPath;
+   std::string outputPath;
+   std::string treeName = "DecayTree";
+   std::string cut;
+   std::string compressionShorthand;
+   std::vector<std::string> branchNames;
+
+   int c;
+   while ((c = getopt(argc, argv, "hvi:o:t:b:x:c:")) != -1) {
+      switch (c) {
+      case 'h':
+      case 'v':
+         Usage(argv[0]);
+         return 0;
+      case 'i':
+         inputPath = optarg;
+         break;
+      case 'o':
+         outputPath = optarg;
+         break;
+      case 't':
+         treeName = optarg;
+         break;
+      case 'b':
+         branchNames = SplitString(optarg, ',');
+         break;
+      case 'x':
+         cut = optarg;
+         break;
+      case 'c':
+         compressionShorthand = optarg;
+         break;
+      default:
+         fprintf(stderr, "Unknown option: -%c\n", c);
+         Usage(argv[0]);
+         return 1;
+      }
+   }
+   if (inputPath.empty() || outputPath.empty()) {
+      Usage(argv[0]);
+      return 1;
+   }
+
+   std::unique_ptr<TFile> inputFile(TFile::Open(inputPath.c_str()));
+   if (!inputFile || inputFile->IsZombie()) {
+      std::cerr << "cannot open " << inputPath << std::endl;
+      return 1;
+   }
+   auto inputTree = inputFile->Get<TTree>(treeName.c_str());
+   if (!inputTree) {
+      std::cerr << "no tree " << treeName << " in " << inputPath << std::endl;
+      return 1;
+   }
+   auto nBranchesInput = inputTree->GetListOfBranches()->GetEntries();
+   auto nEntries = inputTree->GetEntries();
+
+   // First pass: evaluate the cut reading only the branches of the cut
+   std::vector<Long64_t> selected;
+   if (!cut.empty()) {
+      TTreeFormula formula("skim", cut.c_str(), inputTree);
+      if (formula.GetNdim() == 0) {
+         std::cerr << "invalid cut " << cut << std::endl;
+         return 1;
+      }
+      inputTree->SetBranchStatus("*", 0);
+      for (Int_t i = 0; i < formula.GetNcodes(); ++i)
+         EnableLeaf(inputTree, formula.GetLeaf(i));
+      for (decltype(nEntries) entryId = 0; entryId < nEntries; ++entryId) {
+         if (entryId && (entryId % 100000) == 0)
+            std::cout << "Processed " << entryId << " entries" << std::endl;
+         inputTree->LoadTree(entryId);
+         // As in TTree::Draw(), an entry with array branches passes if any of the array elements passes
+         auto nInstances = formula.GetNdata();
+         for (Int_t i = 0; i < nInstances; ++i) {
+            if (formula.EvalInstance(i) != 0) {
+               selected.push_back(entryId);
+               break;
+            }
+         }
+      }
+   }
+
+   // Second pass: copy the selected branches of the selected entries
+   inputTree->SetBranchStatus("*", branchNames.empty() ? 1 : 0);
+   for (const auto &b : branchNames) {
+      auto branch = inputTree->GetBranch(b.c_str());
+      if (!branch) {
+         std::cerr << "no branch " << b << " in " << treeName << std::endl;
+         return 1;
+      }
+      for (auto leaf : TRangeDynCast<TLeaf>(*branch->GetListOfLeaves()))
+         EnableLeaf(inputTree, leaf);
+   }
+
+   std::unique_ptr<TFile> outputFile(TFile::Open(outputPath.c_str(), "RECREATE"));
+   if (!outputFile || outputFile->IsZombie()) {
+      std::cerr << "cannot create " << outputPath << std::endl;
+      return 1;
+   }
+   outputFile->SetCompressionSettings(compressionShorthand.empty() ? inputFile->GetCompressionSettings()
+                                                                    : GetCompressionSettings(compressionShorthand));
+   std::cout << "Skimming " << inputPath << " --> " << outputPath << std::endl;
+
+   TTree *outputTree = nullptr;
+   bool isAllSelected = cut.empty() || (static_cast<Long64_t>(selected.size()) == nEntries);
+   if (isAllSelected && compressionShorthand.empty()) {
+      // All entries are selected: the baskets of the selected branches are copied without decompression
+      outputTree = inputTree->CloneTree(-1, "fast");
+   } else if (isAllSelected) {
+      // A new compression requires to decompress and recompress the baskets
+      outputTree = inputTree->CloneTree(-1);
+   } else {
+      // Fast cloning (TTreeCloner) copies the baskets of the entire tree only, not of an entry range, so that the
+      // selected entries are recompressed even in clusters whose entries are all selected
+      outputTree = inputTree->CloneTree(0);
+      outputTree->SetAutoFlush(inputTree->GetAutoFlush());
+      for (auto entryId : selected) {
+         inputTree->GetEntry(entryId);
+         outputTree->Fill();
+      }
+   }
+
+   outputTree->Write();
+   std::cout << "Skim: " << outputTree->GetEntries() << " of " << nEntries << " entries, "
+             << outputTree->GetListOfBranches()->GetEntries() << " of " << nBranchesInput << " branches, "
+             << inputTree->GetZipBytes() << " --> " << outputTree->GetZipBytes() << " compressed bytes" << std::endl;
+   outputFile->Close();
+   return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include "skimlist.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr std::uint32_t SkimList::kChunkBits;
+constexpr std::uint32_t SkimList::kMaxArraySize;
+
+namespace {
+
+constexpr std::uint32_t kBitmapWords = (1 << SkimList::kChunkBits) / 64;
+
+/// FNV-1a of the cut definition and the identity of the data file
+std::uint64_t GetKey(const std::string &dataPath, const std::string &cut) {
+   struct stat info;
+   if (stat(dataPath.c_str(), &info) != 0) {
+      fprintf(stderr, "skim lists require a local data file, cannot stat %s\n", dataPath.c_str());
+      abort();
+   }
+   std::uint64_t hash = 14695981039346656037ULL;
+   auto fnAdd = [&hash](const void *buf, std::size_t size) {
+      auto bytes = reinterpret_cast<const unsigned char *>(buf);
+      for (std::size_t i = 0; i < size; ++i) {
+         hash ^= bytes[i];
+         hash *= 1099511628211ULL;
+      }
+   };
+   fnAdd(cut.data(), cut.size());
+   std::int64_t size = info.st_size;
+   std::int64_t mtime = info.st_mtime;
+   fnAdd(&size, sizeof(size));
+   fnAdd(&mtime, sizeof(mtime));
+   return hash;
+}
+
+} // anonymous namespace
+
+
+bool SkimList::IsCacheable(const std::string &dataPath) {
+   struct stat info;
+   return stat(dataPath.c_str(), &info) == 0;
+}
+
+
+SkimList::SkimList(const std::string &dataPath, const std::string &cut) : fKey(GetKey(dataPath, cut)) {
+   char hex[17];
+   snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(fKey));
+   fPath = dataPath + "." + hex + ".skim";
+}
+
+
+std::unique_ptr<SkimList> SkimList::Open(const std::string &dataPath, const std::string &cut) {
+   std::unique_ptr<SkimList> skimList(new SkimList(dataPath, cut));
+   std::ifstream file(skimList->fPath, std::ifstream::binary);
+   if (!file)
+      return nullptr;
+
+   auto fnRead = [&file](void *buf, std::size_t size) {
+      if (!file.read(reinterpret_cast<char *>(buf), size)) {
+         fprintf(stderr, "truncated skim list\n");
+         abort();
+      }
+   };
+   std::uint64_t key;
+   std::uint32_t nChunks;
+   fnRead(&key, sizeof(key));
+   fnRead(&skimList->fNEntries, sizeof(skimList->fNEntries));
+   fnRead(&nChunks, sizeof(nChunks));
+   if (key != skimList->fKey) {
+      fprintf(stderr, "skim list %s does not match its key\n", skimList->fPath.c_str());
+      abort();
+   }
+   skimList->fChunks.resize(nChunks);
+   for (auto &c : skimList->fChunks) {
+      fnRead(&c.fUpper, sizeof(c.fUpper));
+      fnRead(&c.fCardinality, sizeof(c.fCardinality));
+      if (c.fCardinality > kMaxArraySize) {
+         c.fBitmap.resize(kBitmapWords);
+         fnRead(c.fBitmap.data(), kBitmapWords * sizeof(std::uint64_t));
+      } else {
+         c.fArray.resize(c.fCardinality);
+         fnRead(c.fArray.data(), c.fCardinality * sizeof(std::uint16_t));
+      }
+   }
+   return skimList;
+}
+
+
+void SkimList::Add(std::uint64_t entry) {
+   std::uint32_t upper = entry >> kChunkBits;
+   std::uint16_t lower = entry & ((1 << kChunkBits) - 1);
+   if (fChunks.empty() || fChunks.back().fUpper != upper) {
+      fChunks.emplace_back(Chunk());
+      fChunks.back().fUpper = upper;
+   }
+   auto &c = fChunks.back();
+   if (c.fBitmap.empty()) {
+      c.fArray.push_back(lower);
+      if (c.fArray.size() > kMaxArraySize) {
+         c.fBitmap.resize(kBitmapWords, 0);
+         for (auto l : c.fArray)
+            c.fBitmap[l / 64] |= std::uint64_t(1) << (l % 64);
+         c.fArray.clear();
+         c.fArray.shrink_to_fit();
+      }
+   } else {
+      c.fBitmap[lower / 64] |= std::uint64_t(1) << (lower % 64);
+   }
+   c.fCardinality++;
+   fNEntries++;
+}
+
+
+void SkimList::Save() const {
+   auto tmpPath = fPath + ".tmp." + std::to_string(getpid());
+   std::ofstream file(tmpPath, std::ofstream::binary | std::ofstream::trunc);
+   auto fnWrite = [&file](const void *buf, std::size_t size) {
+      file.write(reinterpret_cast<const char *>(buf), size);
+   };
+   std::uint32_t nChunks = fChunks.size();
+   fnWrite(&fKey, sizeof(fKey));
+   fnWrite(&fNEntries, sizeof(fNEntries));
+   fnWrite(&nChunks, sizeof(nChunks));
+   for (const auto &c : fChunks) {
+      fnWrite(&c.fUpper, sizeof(c.fUpper));
+      fnWrite(&c.fCardinality, sizeof(c.fCardinality));
+      if (c.fBitmap.empty())
+         fnWrite(c.fArray.data(), c.fArray.size() * sizeof(std::uint16_t));
+      else
+         fnWrite(c.fBitmap.data(), c.fBitmap.size() * sizeof(std::uint64_t));
+   }
+   file.close();
+   if (!file || rename(tmpPath.c_str(), fPath.c_str()) != 0) {
+      fprintf(stderr, "cannot write skim list %s\n", fPath.c_str());
+      unlink(tmpPath.c_str());
+      abort();
+   }
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef SKIMLIST_H_
+#define SKIMLIST_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * The sorted entry numbers that pass a preselection, stored as a compressed bitmap in the style of Roaring bitmaps:
+ * the entry numbers are split into chunks of 2^16 entries; a chunk with few passing entries stores their lower 16
+ * bits as an array, a dense chunk stores a bitmap of 2^16 bits.  The skim list is cached next to the data file as
+ * "<file>.<key>.skim", where the key is a hash of the cut definition and of the size and modification time of the
+ * data file.  A changed cut or a rewritten data file thus results in a new cache file.  The binary layout is
+ *
+ *     uint64 key, uint64 number of entries, uint32 number of chunks
+ *     per chunk: uint32 upper bits, uint32 cardinality, cardinality * uint16 array or 1024 * uint64 bitmap
+ */
+class SkimList {
+public:
+   static constexpr std::uint32_t kChunkBits = 16;
+   /// Chunks with more entries are stored as bitmaps, which then take less space than the array
+   static constexpr std::uint32_t kMaxArraySize = 4096;
+
+   /// Skim lists are keyed by the size and modification time of the data file, which requires a local file
+   static bool IsCacheable(const std::string &dataPath);
+   /// An empty skim list for the data file and the cut, to be filled with Add() and stored with Save()
+   SkimList(const std::string &dataPath, const std::string &cut);
+   /// The cached skim list of the data file and the cut or nullptr if there is none
+   static std::unique_ptr<SkimList> Open(const std::string &dataPath, const std::string &cut);
+
+   /// Entries must be added in ascending order
+   void Add(std::uint64_t entry);
+   /// Writes a temporary file next to the cache file and renames it, so that readers never see a partial skim list
+   void Save() const;
+
+   /// Calls fn(entry) for all entries in ascending order
+   template <typename FnT>
+   void ForEach(FnT &&fn) const {
+      for (const auto &c : fChunks) {
+         std::uint64_t base = static_cast<std::uint64_t>(c.fUpper) << kChunkBits;
+         if (c.fBitmap.empty()) {
+            for (auto lower : c.fArray)
+               fn(base + lower);
+            continue;
+         }
+         for (std::uint32_t w = 0; w < c.fBitmap.size(); ++w) {
+            auto word = c.fBitmap[w];
+            while (word) {
+               fn(base + w * 64 + __builtin_ctzll(word));
+               word &= word - 1;
+            }
+         }
+      }
+   }
+
+   const std::string &GetPath() const { return fPath; }
+   std::uint64_t GetNEntries() const { return fNEntries; }
+
+private:
+   struct Chunk {
+      std::uint32_t fUpper = 0;
+      std::uint32_t fCardinality = 0;
+      std::vector<std::uint16_t> fArray;
+      std::vector<std::uint64_t> fBitmap;
+   };
+
+   std::string fPath;
+   std::uint64_t fKey = 0;
+   std::uint64_t fNEntries = 0;
+   std::vector<Chunk> fChunks;
+};
+
+#endif  // SKIMLIST_H_
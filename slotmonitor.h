@@ -0,0 +1,98 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef SLOTMONITOR_H_
+#define SLOTMONITOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+/**
+ * The stopwatch and load-balance bookkeeping of the RDataFrame analyses.  The first node of the computation graph
+ * calls Tick() with rdfslot_ and rdfentry_ for every entry.  The first tick of any slot starts the analysis
+ * stopwatch, also under implicit multi-threading.  With the detailed report (-b), every slot counts its entries, the
+ * entry ranges it took (a new range starts whenever the entry number is not the successor of the previous one,
+ * i.e. at every new task) and its busy time within ranges versus its idle time between them.  Every slot only
+ * touches its own, cache-line aligned counters.
+ */
+class SlotMonitor {
+   using Clock_t = std::chrono::steady_clock;
+
+   /// Aligned to a cache line, so that the counters of two slots never share one
+   struct alignas(64) SlotStats {
+      std::uint64_t fNEntries = 0;
+      std::uint64_t fNRanges = 0;
+      std::uint64_t fLastEntry = 0;
+      Clock_t::time_point fTsLast;
+      std::chrono::nanoseconds fTimeBusy{0};
+      std::chrono::nanoseconds fTimeIdle{0};
+   };
+
+   bool fIsDetailed;
+   std::vector<SlotStats> fSlots;
+   /// Nanoseconds since the clock's epoch of the first tick, zero before
+   std::atomic<Clock_t::rep> fTsFirst{0};
+
+public:
+   SlotMonitor(unsigned nSlots, bool isDetailed) : fIsDetailed(isDetailed), fSlots(std::max(nSlots, 1U)) {}
+
+   /// Always returns true, so that it can serve as a filter
+   bool Tick(unsigned slot, std::uint64_t entry) {
+      auto now = Clock_t::now();
+      if (fTsFirst.load(std::memory_order_relaxed) == 0) {
+         Clock_t::rep expected = 0;
+         fTsFirst.compare_exchange_strong(expected, now.time_since_epoch().count());
+      }
+
+      auto &s = fSlots[slot];
+      s.fNEntries++;
+      if (!fIsDetailed)
+         return true;
+      if ((s.fNEntries == 1) || (entry != s.fLastEntry + 1)) {
+         s.fNRanges++;
+         s.fTimeIdle += now - ((s.fNEntries == 1) ? GetTsFirst() : s.fTsLast);
+      } else {
+         s.fTimeBusy += now - s.fTsLast;
+      }
+      s.fTsLast = now;
+      s.fLastEntry = entry;
+      return true;
+   }
+
+   Clock_t::time_point GetTsFirst() const {
+      return Clock_t::time_point(Clock_t::duration(fTsFirst.load()));
+   }
+
+   /// Per-slot report and the imbalance of the busy times, i.e. the maximum over the mean
+   void Print(Clock_t::time_point ts_end) const {
+      if (!fIsDetailed)
+         return;
+      using std::chrono::duration_cast;
+      using std::chrono::microseconds;
+
+      std::chrono::nanoseconds busyMax{0};
+      std::chrono::nanoseconds busySum{0};
+      unsigned nActive = 0;
+      for (unsigned i = 0; i < fSlots.size(); ++i) {
+         const auto &s = fSlots[i];
+         auto idle = s.fTimeIdle + ((s.fNEntries > 0) ? (ts_end - s.fTsLast) : (ts_end - GetTsFirst()));
+         std::cout << "Slot-Balance: slot " << i << ": " << s.fNEntries << " entries, " << s.fNRanges
+                   << " ranges, busy " << duration_cast<microseconds>(s.fTimeBusy).count() << "us, idle "
+                   << duration_cast<microseconds>(idle).count() << "us" << std::endl;
+         busyMax = std::max(busyMax, s.fTimeBusy);
+         busySum += s.fTimeBusy;
+         if (s.fNEntries > 0)
+            nActive++;
+      }
+      double busyMean = static_cast<double>(busySum.count()) / fSlots.size();
+      std::cout << "Slot-Balance: " << nActive << " of " << fSlots.size() << " slots active, imbalance "
+                << ((busyMean > 0) ? (busyMax.count() / busyMean) : 0.) << std::endl;
+   }
+};
+
+#endif  // SLOTMONITOR_H_
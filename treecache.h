@@ -0,0 +1,161 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef TREECACHE_H_
+#define TREECACHE_H_
+
+#include <TBranch.h>
+#include <TFile.h>
+#include <TROOT.h>
+#include <TTree.h>
+#include <TTreeCache.h>
+#include <TTreeCacheUnzip.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+/**
+ * Explicit tree cache settings of the TTree direct analyses (-T <size in MB>[,fill]).  Without them, the tree cache
+ * has its default size and learns the branches to cache during the first entries.  With them, exactly the branches
+ * of the analysis are registered and the learning phase is skipped, which puts TTree on par with the explicitly
+ * configured RNTuple cluster pool.  With "fill", reading the first cluster starts before the event loop.
+ */
+class TreeCacheConfig {
+   /// Negative: default tree cache; zero: no tree cache
+   Long64_t fSizeMB = -1;
+   bool fPrefill = false;
+
+public:
+   static TreeCacheConfig Parse(const std::string &spec) {
+      TreeCacheConfig config;
+      auto parts = SplitString(spec, ',');
+      config.fSizeMB = String2Uint64(parts[0]);
+      config.fPrefill = (parts.size() > 1) && (parts[1] == "fill");
+      return config;
+   }
+
+   bool IsSet() const { return fSizeMB >= 0; }
+   bool IsDisabled() const { return fSizeMB == 0; }
+
+   /// Starts reading the baskets of the registered branches of the first cluster.  With asynchronous prefetching,
+   /// the tree cache hands the reads to its prefetch thread and returns, so that the reads overlap with the rest of
+   /// the setup of the analysis.
+   static void Prefill(TTree *tree) {
+      tree->LoadTree(0);
+      auto cache = tree->GetReadCache(tree->GetCurrentFile());
+      if (!cache)
+         return;
+      cache->SetEnablePrefetching(true);
+      cache->FillBuffer();
+   }
+
+   void Apply(TTree *tree, const std::vector<TBranch *> &branches) const {
+      if (!IsSet())
+         return;
+      tree->SetCacheSize(fSizeMB * 1024 * 1024);
+      if (fSizeMB == 0) {
+         std::cout << "Tree-Cache: disabled" << std::endl;
+         return;
+      }
+      for (auto b : branches)
+         tree->AddBranchToCache(b);
+      tree->StopCacheLearningPhase();
+      if (fPrefill)
+         Prefill(tree);
+      std::cout << "Tree-Cache: " << fSizeMB << " MB, " << branches.size() << " branches"
+                << (fPrefill ? ", prefilled" : "") << std::endl;
+   }
+
+   /// Like Apply() but also without -T: the tree cache, of default size unless -T gives one, holds only the given
+   /// branches, so that the baskets of all other branches are read one by one on GetEntry() and only if needed
+   void ApplyExclusive(TTree *tree, const std::vector<TBranch *> &branches) const {
+      if (IsSet()) {
+         Apply(tree, branches);
+         return;
+      }
+      tree->SetCacheSize(-1);
+      for (auto b : branches)
+         tree->AddBranchToCache(b);
+      tree->StopCacheLearningPhase();
+      std::cout << "Tree-Cache: default size, " << branches.size() << " branches" << std::endl;
+   }
+
+   /// Baskets served from the cache relative to the baskets prefetched and to all baskets read, and the reads
+   /// that missed the cache
+   static void PrintStats(TTree *tree) {
+      auto cache = tree->GetReadCache(tree->GetCurrentFile());
+      if (!cache) {
+         std::cout << "Tree-Cache: no cache" << std::endl;
+         return;
+      }
+      std::cout << "Tree-Cache: efficiency " << (100. * cache->GetEfficiency()) << "% of prefetched baskets, "
+                << (100. * cache->GetEfficiencyRel()) << "% of read baskets, " << cache->GetNoCacheReadCalls()
+                << " uncached reads (" << cache->GetNoCacheBytesRead() / 1024 << " kB)" << std::endl;
+      // Unzipped, found, stalled, and missed baskets
+      if (dynamic_cast<TTreeCacheUnzip *>(cache))
+         cache->Print();
+   }
+};
+
+
+/**
+ * Parallel basket unzipping of the TTree direct analyses (-Z <threads>[,<budget in MB>]).  The tree cache becomes a
+ * TTreeCacheUnzip: as soon as the baskets of a cluster are read, they are decompressed by the implicit
+ * multi-threading pool ahead of the event loop, so that GetEntry() finds them unzipped.  The budget bounds the
+ * memory of the unzipped baskets held ahead of the event loop; by default, it is TTreeCacheUnzip's default
+ * relative to the tree cache size.
+ */
+class TreeUnzipConfig {
+   unsigned fNThreads = 0;
+   /// Negative: default budget
+   Long64_t fBudgetMB = -1;
+
+public:
+   static TreeUnzipConfig Parse(const std::string &spec) {
+      TreeUnzipConfig config;
+      auto parts = SplitString(spec, ',');
+      config.fNThreads = String2Uint64(parts[0]);
+      if (parts.size() > 1)
+         config.fBudgetMB = String2Uint64(parts[1]);
+      return config;
+   }
+
+   bool IsSet() const { return fNThreads > 0; }
+
+   /// Must be called before the tree cache is created, i.e. before the tree is read or its cache is configured
+   void Enable() const {
+      if (!IsSet())
+         return;
+      // -m may have started the pool already
+      if (!ROOT::IsImplicitMTEnabled())
+         ROOT::EnableImplicitMT(fNThreads);
+      TTreeCacheUnzip::SetParallelUnzip(TTreeCacheUnzip::kEnable);
+   }
+
+   /// Sets the budget on the tree cache, which is created with the default size if necessary.  The analyses reject
+   /// -Z together with -T 0, which would otherwise re-create the disabled cache.
+   void Apply(TTree *tree) const {
+      if (!IsSet())
+         return;
+      if (!tree->GetReadCache(tree->GetCurrentFile()))
+         tree->SetCacheSize(-1);
+      auto cache = dynamic_cast<TTreeCacheUnzip *>(tree->GetReadCache(tree->GetCurrentFile()));
+      if (!cache) {
+         std::cout << "Tree-Unzip: no parallel unzip cache" << std::endl;
+         return;
+      }
+      if (fBudgetMB >= 0)
+         cache->SetUnzipBufferSize(fBudgetMB * 1024 * 1024);
+      std::cout << "Tree-Unzip: " << ROOT::GetImplicitMTPoolSize() << " threads, budget ";
+      if (fBudgetMB >= 0)
+         std::cout << fBudgetMB << " MB" << std::endl;
+      else
+         std::cout << "default" << std::endl;
+   }
+};
+
+#endif  // TREECACHE_H_
@@ -0,0 +1,48 @@
+#!/bin/sh
+
+# Cross-checks the control histograms of an analysis between TTree and RNTuple, direct access and RDataFrame,
+# and serial and multi-threaded runs.  The TTree direct access result is the reference.
+#
+# Usage: ./validate.sh <analysis> <data file without suffix>
+# Example: ./validate.sh lhcb /data/calibration/B2HHH~zstd
+
+ANALYSIS=$1
+INPUT=$2
+VALIDATE_TOLERANCE=${VALIDATE_TOLERANCE:-1e-9}
+VALIDATE_DIR=${VALIDATE_DIR:-validate_${ANALYSIS}}
+VALIDATE_THREADS=${VALIDATE_THREADS:-4}
+
+if [ "x$ANALYSIS" = "x" ] || [ "x$INPUT" = "x" ]; then
+  echo "Usage: $0 <analysis> <data file without suffix>"
+  exit 1
+fi
+
+mkdir -p $VALIDATE_DIR
+./$ANALYSIS -i $INPUT.root -o $VALIDATE_DIR/reference.root > /dev/null || exit 1
+
+# The RDataFrame variants only for the analyses that have an RDataFrame implementation
+VARIANTS="ntuple: root:-r ntuple:-r root:-r_-m ntuple:-r_-m"
+# The multi-threaded TTree direct access (work-stealing scheduler) only for the analyses that have one
+case $ANALYSIS in
+  atlas) VARIANTS="ntuple:" ;;
+  cms|h1) VARIANTS="$VARIANTS root:-t_$VALIDATE_THREADS" ;;
+esac
+
+NFAILED=0
+for variant in $VARIANTS; do
+  format=$(echo $variant | cut -d: -f1)
+  flags=$(echo $variant | cut -d: -f2 | tr '_' ' ')
+  name=$(echo "$format$flags" | tr -d ' ')
+  echo "*** $name"
+  if ! ./$ANALYSIS $flags -i $INPUT.$format -o $VALIDATE_DIR/$name.root > /dev/null; then
+    echo "    failed to run"
+    NFAILED=$((NFAILED + 1))
+    continue
+  fi
+  if ! ./hist_compare -t $VALIDATE_TOLERANCE $VALIDATE_DIR/reference.root $VALIDATE_DIR/$name.root; then
+    NFAILED=$((NFAILED + 1))
+  fi
+done
+
+echo "$NFAILED variant(s) failed"
+[ $NFAILED -eq 0 ]
@@ -0,0 +1,173 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include "workstealing.h"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+WorkStealingScheduler::WorkStealingScheduler(unsigned nWorkers, std::uint64_t minRangeSize,
+                                             const NumaPlacement *placement)
+   : fMinRangeSize(std::max<std::uint64_t>(minRangeSize, 1)), fPlacement(placement)
+{
+   nWorkers = std::max(nWorkers, 1U);
+   for (unsigned i = 0; i < nWorkers; ++i) {
+      fWorkers.emplace_back(new Worker());
+      if (fPlacement)
+         fWorkers[i]->fNode = fPlacement->GetNode(i, nWorkers);
+   }
+}
+
+
+bool WorkStealingScheduler::PopOwn(unsigned workerId, Range *range) {
+   auto &w = *fWorkers[workerId];
+   std::lock_guard<std::mutex> guard(w.fLock);
+   if (w.fRanges.empty())
+      return false;
+   *range = w.fRanges.front();
+   w.fRanges.pop_front();
+   fNQueued--;
+   return true;
+}
+
+
+bool WorkStealingScheduler::Steal(unsigned thiefId, bool isLocal, Range *range) {
+   // Start with the neighbor so that the thieves spread over the victims
+   for (unsigned i = 1; i < fWorkers.size(); ++i) {
+      auto &victim = *fWorkers[(thiefId + i) % fWorkers.size()];
+      if ((victim.fNode == fWorkers[thiefId]->fNode) != isLocal)
+         continue;
+      std::lock_guard<std::mutex> guard(victim.fLock);
+      if (victim.fRanges.empty())
+         continue;
+      *range = victim.fRanges.back();
+      victim.fRanges.pop_back();
+      fNQueued--;
+      return true;
+   }
+   return false;
+}
+
+
+void WorkStealingScheduler::NotifyIdle() {
+   // Taking the lock orders the notification after a concurrent check of the wait condition
+   { std::lock_guard<std::mutex> guard(fIdleLock); }
+   fIdleCondition.notify_all();
+}
+
+
+void WorkStealingScheduler::Work(unsigned workerId, const WorkerFunc_t &fnInit, const RangeFunc_t &fnRun,
+                                 const RangeFunc_t &fnHint)
+{
+   auto &w = *fWorkers[workerId];
+   if (fPlacement)
+      fPlacement->PinThread(w.fNode);
+   fnInit(workerId);
+   {
+      std::unique_lock<std::mutex> lock(fIdleLock);
+      if (++fNReady == fWorkers.size()) {
+         fTsReady = std::chrono::steady_clock::now();
+         fIdleCondition.notify_all();
+      }
+      fIdleCondition.wait(lock, [this]{ return fNReady == fWorkers.size(); });
+   }
+
+   bool isIdle = false;
+   while (fNPending.load() > 0) {
+      Range range;
+      bool isStolen = false;
+      bool isRemote = false;
+      if (!PopOwn(workerId, &range)) {
+         // Remote victims only once the own node ran out of work
+         isStolen = Steal(workerId, true /* isLocal */, &range);
+         if (!isStolen)
+            isStolen = isRemote = Steal(workerId, false /* isLocal */, &range);
+         if (!isStolen) {
+            if (!isIdle) {
+               fNIdle++;
+               isIdle = true;
+            }
+            std::unique_lock<std::mutex> lock(fIdleLock);
+            fIdleCondition.wait(lock, [this]{ return fNQueued.load() > 0 || fNPending.load() == 0; });
+            continue;
+         }
+      }
+      if (isIdle) {
+         fNIdle--;
+         isIdle = false;
+      }
+
+      // Split on demand, the second half can be stolen by the idle workers
+      while ((fNIdle.load() > 0) && (range.fLast - range.fFirst >= 2 * fMinRangeSize)) {
+         auto middle = range.fFirst + (range.fLast - range.fFirst) / 2;
+         // Count the new range before it is published, a thief may finish it right away
+         fNPending++;
+         fNQueued++;
+         {
+            std::lock_guard<std::mutex> guard(w.fLock);
+            w.fRanges.push_front(Range{middle, range.fLast});
+         }
+         w.fNSplits++;
+         range.fLast = middle;
+         NotifyIdle();
+      }
+
+      auto ts_start = std::chrono::steady_clock::now();
+      if (isStolen) {
+         w.fNStolen++;
+         if (isRemote)
+            w.fNStolenRemote++;
+         fnHint(workerId, range);
+      }
+      fnRun(workerId, range);
+      w.fTimeBusy += std::chrono::steady_clock::now() - ts_start;
+      w.fNRanges++;
+      if (--fNPending == 0)
+         NotifyIdle();
+   }
+   if (isIdle)
+      fNIdle--;
+   w.fTsDone = std::chrono::steady_clock::now();
+}
+
+
+void WorkStealingScheduler::Run(const std::vector<Range> &ranges, const WorkerFunc_t &fnInit,
+                                const RangeFunc_t &fnRun, const RangeFunc_t &fnHint)
+{
+   auto nWorkers = fWorkers.size();
+   for (std::size_t i = 0; i < ranges.size(); ++i) {
+      // Contiguous blocks of ranges, the first workers get one more if the ranges do not divide evenly
+      fWorkers[i * nWorkers / ranges.size()]->fRanges.push_back(ranges[i]);
+   }
+   fNPending = ranges.size();
+   fNQueued = ranges.size();
+   fNReady = 0;
+
+   std::vector<std::thread> threads;
+   for (unsigned i = 0; i < nWorkers; ++i)
+      threads.emplace_back(&WorkStealingScheduler::Work, this, i, std::cref(fnInit), std::cref(fnRun),
+                           std::cref(fnHint));
+   for (auto &t : threads)
+      t.join();
+}
+
+
+void WorkStealingScheduler::PrintStats() const {
+   using std::chrono::duration_cast;
+   using std::chrono::microseconds;
+
+   auto tsFirstDone = fWorkers[0]->fTsDone;
+   auto tsLastDone = fWorkers[0]->fTsDone;
+   for (unsigned i = 0; i < fWorkers.size(); ++i) {
+      const auto &w = *fWorkers[i];
+      std::cout << "Work-Stealing: worker " << i << " (node " << w.fNode << "): " << w.fNRanges << " ranges, "
+                << w.fNStolen << " stolen (" << w.fNStolenRemote << " remote), " << w.fNSplits << " splits, busy "
+                << duration_cast<microseconds>(w.fTimeBusy).count() << "us" << std::endl;
+      tsFirstDone = std::min(tsFirstDone, w.fTsDone);
+      tsLastDone = std::max(tsLastDone, w.fTsDone);
+   }
+   std::cout << "Work-Stealing: " << fWorkers.size() << " workers, tail "
+             << duration_cast<microseconds>(tsLastDone - tsFirstDone).count() << "us" << std::endl;
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef WORKSTEALING_H_
+#define WORKSTEALING_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "numa.h"
+
+/**
+ * Runs entry ranges, typically the clusters of a file, on a fixed set of worker threads.  Every worker owns a deque
+ * of ranges, initially a contiguous block of the input ranges.  A worker takes ranges from the front of its own
+ * deque, so that it reads its block in order; an idle worker steals from the back of the deque of another worker,
+ * i.e. the work the owner would reach last.  A stolen range is announced to the thief through the hint callback
+ * before it runs, e.g. to prefetch its baskets.  While workers are idle, a range larger than twice the minimum
+ * range size is split in halves before it runs; the second half goes back to the deque where it can be stolen.
+ * This keeps all workers busy until the very end of the input.  With placement, the workers are pinned to the NUMA
+ * nodes in contiguous groups, so that every node receives a contiguous part of the input, and thieves prefer victims
+ * on their own node.  The per-worker state is created by the init callback on the pinned worker thread, i.e. in
+ * node-local memory.  Workers without work, and workers waiting for the others to finish their initialization, sleep
+ * on a condition variable; they are woken by a split, which queues new work, or by the end of the input.
+ */
+class WorkStealingScheduler {
+public:
+   /// The entries [fFirst, fLast)
+   struct Range {
+      std::uint64_t fFirst;
+      std::uint64_t fLast;
+   };
+   using RangeFunc_t = std::function<void(unsigned workerId, const Range &range)>;
+   using WorkerFunc_t = std::function<void(unsigned workerId)>;
+
+   WorkStealingScheduler(unsigned nWorkers, std::uint64_t minRangeSize, const NumaPlacement *placement = nullptr);
+   WorkStealingScheduler(const WorkStealingScheduler &other) = delete;
+   WorkStealingScheduler &operator =(const WorkStealingScheduler &other) = delete;
+
+   unsigned GetNWorkers() const { return fWorkers.size(); }
+   /// Returns when all ranges have been processed by fnRun.  Every worker calls fnInit first; processing starts
+   /// once all workers are initialized.  fnHint is called for every stolen range.
+   void Run(const std::vector<Range> &ranges, const WorkerFunc_t &fnInit, const RangeFunc_t &fnRun,
+            const RangeFunc_t &fnHint);
+   /// The end of the initialization of the last worker, i.e. the start of the processing
+   std::chrono::steady_clock::time_point GetTsReady() const { return fTsReady; }
+   /// Per-worker ranges, steals, splits, and busy time, and the tail, i.e. the time between the first and the last
+   /// worker running out of work
+   void PrintStats() const;
+
+private:
+   struct Worker {
+      unsigned fNode = 0;
+      std::mutex fLock;
+      std::deque<Range> fRanges;
+      std::uint64_t fNRanges = 0;
+      std::uint64_t fNStolen = 0;
+      /// Stolen from a worker on another NUMA node
+      std::uint64_t fNStolenRemote = 0;
+      std::uint64_t fNSplits = 0;
+      std::chrono::nanoseconds fTimeBusy{0};
+      std::chrono::steady_clock::time_point fTsDone;
+   };
+
+   bool PopOwn(unsigned workerId, Range *range);
+   bool Steal(unsigned thiefId, bool isLocal, Range *range);
+   /// Wakes up the idle workers after new ranges have been queued or the last range has been processed
+   void NotifyIdle();
+   void Work(unsigned workerId, const WorkerFunc_t &fnInit, const RangeFunc_t &fnRun, const RangeFunc_t &fnHint);
+
+   std::uint64_t fMinRangeSize;
+   const NumaPlacement *fPlacement;
+   std::vector<std::unique_ptr<Worker>> fWorkers;
+   /// Ranges queued or running; the workers stop when there are none left
+   std::atomic<std::uint64_t> fNPending{0};
+   /// Ranges in the deques, i.e. ranges that can be taken by an idle worker
+   std::atomic<std::uint64_t> fNQueued{0};
+   std::atomic<unsigned> fNIdle{0};
+   unsigned fNReady = 0;
+   /// Protects fNReady and the sleep of the idle workers
+   std::mutex fIdleLock;
+   std::condition_variable fIdleCondition;
+   std::chrono::steady_clock::time_point fTsReady;
+};
+
+#endif  // WORKSTEALING_H_
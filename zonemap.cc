@@ -0,0 +1,97 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#include "zonemap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+
+constexpr std::uint64_t ZoneMap::kDefaultZoneSize;
+
+ZoneMap ZoneMap::Load(const std::string &path) {
+   std::ifstream file(path);
+   std::uint64_t zoneSize = 0;
+   if (!(file >> zoneSize) || zoneSize == 0) {
+      fprintf(stderr, "cannot read zone map %s\n", path.c_str());
+      abort();
+   }
+   ZoneMap zoneMap(zoneSize);
+   std::string name;
+   std::uint64_t zone;
+   // Read as strings because operator>> does not parse "inf" for empty zones
+   std::string min;
+   std::string max;
+   Zone z;
+   while (file >> name >> zone >> min >> max >> z.fHasNaN) {
+      z.fMin = std::strtod(min.c_str(), nullptr);
+      z.fMax = std::strtod(max.c_str(), nullptr);
+      if (zoneMap.fColumns.empty() || zoneMap.fColumns.back().fName != name)
+         zoneMap.AddColumn(name);
+      auto &zones = zoneMap.fColumns.back().fZones;
+      if (zones.size() <= zone)
+         zones.resize(zone + 1);
+      zones[zone] = z;
+      if (zoneMap.fSelected.size() <= zone)
+         zoneMap.fSelected.resize(zone + 1, true);
+   }
+   return zoneMap;
+}
+
+
+void ZoneMap::Save(const std::string &path) const {
+   std::ofstream file(path, std::ofstream::out | std::ofstream::trunc);
+   file << fZoneSize << std::endl;
+   file << std::setprecision(std::numeric_limits<double>::max_digits10);
+   for (const auto &c : fColumns) {
+      for (std::size_t i = 0; i < c.fZones.size(); ++i)
+         file << c.fName << " " << i << " " << c.fZones[i].fMin << " " << c.fZones[i].fMax << " " << c.fZones[i].fHasNaN
+              << std::endl;
+   }
+}
+
+
+unsigned ZoneMap::AddColumn(const std::string &name) {
+   fColumns.push_back(Column{name, {}});
+   return fColumns.size() - 1;
+}
+
+
+void ZoneMap::Update(unsigned column, std::uint64_t entry, double value) {
+   auto zone = entry / fZoneSize;
+   auto &zones = fColumns[column].fZones;
+   if (zones.size() <= zone)
+      zones.resize(zone + 1);
+   if (std::isnan(value)) {
+      zones[zone].fHasNaN = true;
+   } else {
+      zones[zone].fMin = std::min(zones[zone].fMin, value);
+      zones[zone].fMax = std::max(zones[zone].fMax, value);
+   }
+   if (fSelected.size() <= zone)
+      fSelected.resize(zone + 1, true);
+}
+
+
+void ZoneMap::AddRange(const std::string &column, double min, double max) {
+   for (const auto &c : fColumns) {
+      if (c.fName != column)
+         continue;
+      for (std::size_t i = 0; i < c.fZones.size(); ++i) {
+         if (c.fZones[i].fHasNaN)
+            continue;
+         if ((c.fZones[i].fMax < min) || (c.fZones[i].fMin > max))
+            fSelected[i] = false;
+      }
+   }
+}
+
+
+std::uint64_t ZoneMap::GetNSelected() const {
+   return std::count(fSelected.begin(), fSelected.end(), true);
+}
@@ -0,0 +1,77 @@
+/**
+ * Copyright CERN; jblomer@cern.ch
+ */
+
+#ifndef ZONEMAP_H_
+#define ZONEMAP_H_
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Minimum and maximum value of numeric columns per zone of a fixed number of consecutive entries.  The generators
+ * fill the zone map while writing and store it next to the output file as "<file>.zonemap", a text file with the
+ * zone size in the first line followed by one "column zone min max hasNaN" line per column and zone.  The analyses add
+ * the ranges of their cuts and skip the zones where no entry can pass.  Entries are the same in the TTree and the
+ * ntuple version of a sample, so the zone map applies to both.  A zone with a NaN value in a column is never skipped
+ * by a range on that column, as NaN fails every comparison of the cuts and thus passes them.  Open-ended ranges use
+ * infinity.
+ *
+ * Zones are blocks of entries that are not aligned to baskets or clusters.  Skipping a zone saves the evaluation
+ * of the cuts and the decompression of baskets and pages that lie entirely within skipped zones, but the TTree
+ * cache and the ntuple cluster pool still read every cluster that a selected zone touches.
+ */
+class ZoneMap {
+public:
+   static constexpr std::uint64_t kDefaultZoneSize = 10000;
+
+   explicit ZoneMap(std::uint64_t zoneSize = kDefaultZoneSize) : fZoneSize(zoneSize) {}
+   static ZoneMap Load(const std::string &path);
+   void Save(const std::string &path) const;
+
+   /// Registers a column; returns the index to be used with Update()
+   unsigned AddColumn(const std::string &name);
+   void Update(unsigned column, std::uint64_t entry, double value);
+   /// Non-numeric members, e.g. of the H1 event class, are not recorded
+   template <typename T>
+   typename std::enable_if<std::is_arithmetic<T>::value>::type UpdateAny(unsigned column, std::uint64_t entry,
+                                                                         const T &value)
+   {
+      Update(column, entry, static_cast<double>(value));
+   }
+   template <typename T>
+   typename std::enable_if<!std::is_arithmetic<T>::value>::type UpdateAny(unsigned, std::uint64_t, const T &) {}
+
+   /// Restricts the values of the column to [min, max].  Unknown columns are ignored.
+   void AddRange(const std::string &column, double min, double max);
+   /// False if, according to the ranges, no entry of the entry's zone can pass
+   bool IsSelected(std::uint64_t entry) const {
+      auto zone = entry / fZoneSize;
+      return (zone >= fSelected.size()) || fSelected[zone];
+   }
+   /// The first entry of the next zone
+   std::uint64_t GetZoneEnd(std::uint64_t entry) const { return (entry / fZoneSize + 1) * fZoneSize; }
+   std::uint64_t GetZoneSize() const { return fZoneSize; }
+   std::uint64_t GetNZones() const { return fSelected.size(); }
+   std::uint64_t GetNSelected() const;
+
+private:
+   struct Zone {
+      double fMin = std::numeric_limits<double>::infinity();
+      double fMax = -std::numeric_limits<double>::infinity();
+      bool fHasNaN = false;
+   };
+   struct Column {
+      std::string fName;
+      std::vector<Zone> fZones;
+   };
+
+   std::uint64_t fZoneSize;
+   std::vector<Column> fColumns;
+   std::vector<bool> fSelected;
+};
+
+#endif  // ZONEMAP_H_